@@ -0,0 +1,352 @@
+// End-to-end benchmark: renders a fixed camera path over a few scenes,
+// headless, and reports the frame times & throughputs as JSON
+
+#include "softengine.h"
+
+#include <glm/gtc/constants.hpp>
+// glm::pi
+
+#include <cstdio>   // std::sscanf
+#include <sstream>
+
+// A scene to benchmark, and how far from its center the camera orbits
+struct BenchScene
+{
+    std::string name;
+    std::vector<Mesh> meshes;
+    float cameraDistance;
+};
+
+// UV sphere: many small triangles in one mesh, textured when a texture is given
+Mesh makeSphere(int rings, int segments, float radius, std::shared_ptr<const Texture> texture = nullptr)
+{
+    Mesh mesh{};
+    mesh.vertices.resize((rings + 1) * (segments + 1), texture != nullptr);
+
+    size_t i = 0;
+    for(int r = 0; r <= rings; r++)
+    {
+        const float phi = glm::pi<float>() * r / rings;
+        for(int s = 0; s <= segments; s++, i++)
+        {
+            const float theta = 2.0f * glm::pi<float>() * s / segments;
+            const glm::vec3 n(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+            mesh.vertices.x[i] = n.x * radius;
+            mesh.vertices.y[i] = n.y * radius;
+            mesh.vertices.z[i] = n.z * radius;
+            mesh.vertices.nx[i] = n.x;
+            mesh.vertices.ny[i] = n.y;
+            mesh.vertices.nz[i] = n.z;
+            if(texture)
+            {
+                mesh.vertices.u[i] = 4.0f * s / segments;
+                mesh.vertices.v[i] = 2.0f * r / rings;
+            }
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    for(int r = 0; r < rings; r++)
+    {
+        for(int s = 0; s < segments; s++)
+        {
+            const uint32_t a = r * (segments + 1) + s;
+            const uint32_t b = a + segments + 1;
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+    mesh.faces = makeFaces(indices, mesh.vertices.size());
+
+    mesh.bounds = computeBounds(mesh.vertices);
+    mesh.texture = std::move(texture);
+    return mesh;
+}
+
+// Checkerboard texture of size x size texels, in squares of cell texels
+std::shared_ptr<const Texture> makeChecker(int size, int cell)
+{
+    std::vector<uint32_t> pixels(size * size);
+    for(int y = 0; y < size; y++)
+    {
+        for(int x = 0; x < size; x++)
+        {
+            const bool odd = ((x / cell) + (y / cell)) % 2 != 0;
+            pixels[x + y * size] = odd ? toRGBA8888({ 230, 200, 40, 255 }) : toRGBA8888({ 30, 60, 160, 255 });
+        }
+    }
+    return std::make_shared<Texture>(size, size, pixels.data());
+}
+
+// Grid of copies of a mesh on the XZ plane: many meshes hiding each other
+std::vector<Mesh> makeGrid(const Mesh &mesh, int count, float spacing)
+{
+    std::vector<Mesh> meshes;
+    for(int z = 0; z < count; z++)
+    {
+        for(int x = 0; x < count; x++)
+        {
+            meshes.push_back(mesh);
+            meshes.back().position = glm::vec3((x - (count - 1) * 0.5f) * spacing,
+                                               0.0f,
+                                               (z - (count - 1) * 0.5f) * spacing);
+        }
+    }
+    return meshes;
+}
+
+// The fixed camera path: one turn around the scene's center, slightly above it
+Camera cameraAt(int frame, int frameCount, float distance)
+{
+    const float angle = 2.0f * glm::pi<float>() * frame / frameCount;
+    return {
+        { distance * std::sin(angle), distance * 0.3f, -distance * std::cos(angle) },
+        { 0, 0, 0 }
+    };
+}
+
+std::vector<std::string> split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+// Renders the camera path once, and returns one JSON result
+tao::json::value run(const BenchScene &scene, int width, int height,
+                     Rasterizer rasterizer, unsigned threadCount, bool deferredShading,
+                     int warmupCount, int frameCount)
+{
+    Device device(width, height);
+    device.setRasterizer(rasterizer);
+    device.setThreadCount(threadCount);
+    device.setDeferredShading(deferredShading);
+
+    std::vector<double> frameTimes;     // ms
+    uint64_t triangles = 0;
+    uint64_t pixels = 0;
+    uint64_t shaded = 0;
+    for(int frame = -warmupCount; frame < frameCount; frame++)
+    {
+        const auto camera = cameraAt(std::max(frame, 0), frameCount, scene.cameraDistance);
+
+        const auto start = std::chrono::steady_clock::now();
+        device.clear({ 0, 0, 0, 255 });
+        device.render(camera, scene.meshes);
+        device.colorBuffer(); // resolves the frame, as presenting it would
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        if(frame >= 0)
+        {
+            frameTimes.push_back(elapsed.count());
+            triangles += device.stats().triangles;
+            pixels += device.stats().pixels;
+            shaded += device.stats().shaded;
+        }
+    }
+
+    double total = 0;
+    for(const auto t : frameTimes)
+    {
+        total += t;
+    }
+    std::sort(frameTimes.begin(), frameTimes.end());
+    const auto percentile = [&](double p)
+    {
+        const auto rank = static_cast<size_t>(std::ceil(p * frameTimes.size()));
+        return frameTimes[std::min(frameTimes.size() - 1, std::max<size_t>(rank, 1) - 1)];
+    };
+
+    size_t sceneTriangles = 0;
+    for(const auto &mesh : scene.meshes)
+    {
+        sceneTriangles += mesh.faces.size();
+    }
+
+    const double seconds = total / 1000.0;
+    return {
+        { "scene", scene.name },
+        { "meshes", scene.meshes.size() },
+        { "scene_triangles", sceneTriangles },
+        { "width", width },
+        { "height", height },
+        { "rasterizer", rasterizer == Rasterizer::HalfSpace ? "halfspace" : "scanline" },
+        { "threads", threadCount },
+        { "shading", deferredShading ? "deferred" : "forward" },
+        { "frames", frameCount },
+        { "ms_per_frame", {
+            { "mean", total / frameTimes.size() },
+            { "p50", percentile(0.50) },
+            { "p99", percentile(0.99) }
+        } },
+        { "triangles_per_second", triangles / seconds },
+        { "pixels_per_second", pixels / seconds },
+        { "shaded_per_second", shaded / seconds }
+    };
+}
+
+// Usage: softengine_bench [--frames N] [--warmup N] [--scenes cube,monkey,monkeys,sphere,textured]
+//                         [--resolutions 320x240,640x480,...] [--threads 1,2,...]
+//                         [--shading forward,deferred]
+//                         [--data directory] [--output results.json]
+//   --frames       frames measured along the camera path (default: 120)
+//   --warmup       frames rendered before measuring (default: 10)
+//   --scenes       scenes to render (default: all)
+//                    cube, monkey: data/cube.babylon & data/monkey.babylon
+//                    monkeys: 8x8 grid of monkeys, hiding each other
+//                    sphere: one sphere of 32K triangles
+//                    textured: the same sphere, with a 512x512 texture
+//   --resolutions  frame sizes (default: 320x240,640x480,1280x720,1920x1080)
+//   --threads      thread counts of the half-space rasterizer (default: 1,2,4 & one per core);
+//                  the scanline rasterizer always runs once, on one thread
+//   --shading      shading modes of the half-space rasterizer (default: both),
+//                  deferred shading each visible pixel once (see Device::setDeferredShading)
+//   --data         directory of the .babylon files (default: data)
+//   --output       writes the JSON results to a file instead of the standard output
+int main(int argc, char **argv)
+{
+    int frameCount = 120;
+    int warmupCount = 10;
+    std::vector<std::string> sceneNames = { "cube", "monkey", "monkeys", "sphere", "textured" };
+    std::vector<std::string> resolutions = { "320x240", "640x480", "1280x720", "1920x1080" };
+    std::vector<unsigned> threadCounts = { 1, 2, 4 };
+    std::vector<std::string> shadings = { "forward", "deferred" };
+    std::string dataDirectory = "data";
+    std::string output;
+
+    const unsigned cores = std::thread::hardware_concurrency();
+    if(cores > 4)
+    {
+        threadCounts.push_back(cores);
+    }
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if(arg == "--frames" && i+1 < argc)
+            frameCount = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--warmup" && i+1 < argc)
+            warmupCount = std::max(0, std::stoi(argv[++i]));
+        else if(arg == "--scenes" && i+1 < argc)
+            sceneNames = split(argv[++i]);
+        else if(arg == "--resolutions" && i+1 < argc)
+            resolutions = split(argv[++i]);
+        else if(arg == "--threads" && i+1 < argc)
+        {
+            threadCounts.clear();
+            for(const auto &value : split(argv[++i]))
+            {
+                int count = 0;
+                char extra;
+                if(std::sscanf(value.c_str(), "%d%c", &count, &extra) != 1 || count < 1)
+                {
+                    std::cerr << "Invalid thread count: " << value << std::endl;
+                    return 1;
+                }
+                threadCounts.push_back(count);
+            }
+            if(threadCounts.empty())
+            {
+                std::cerr << "Invalid thread counts: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if(arg == "--shading" && i+1 < argc)
+        {
+            shadings = split(argv[++i]);
+            for(const auto &shading : shadings)
+            {
+                if(shading != "forward" && shading != "deferred")
+                {
+                    std::cerr << "Unknown shading: " << shading << std::endl;
+                    return 1;
+                }
+            }
+        }
+        else if(arg == "--data" && i+1 < argc)
+            dataDirectory = argv[++i];
+        else if(arg == "--output" && i+1 < argc)
+            output = argv[++i];
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<BenchScene> scenes;
+    for(const auto &name : sceneNames)
+    {
+        if(name == "cube" || name == "monkey")
+        {
+            scenes.push_back({ name, loadCachedMesh(dataDirectory + "/" + name + ".babylon"), 6.0f });
+        }
+        else if(name == "monkeys")
+        {
+            const auto monkey = loadCachedMesh(dataDirectory + "/monkey.babylon");
+            scenes.push_back({ name, makeGrid(monkey.at(0), 8, 3.0f), 20.0f });
+        }
+        else if(name == "sphere")
+        {
+            scenes.push_back({ name, { makeSphere(128, 128, 2.0f) }, 6.0f });
+        }
+        else if(name == "textured")
+        {
+            scenes.push_back({ name, { makeSphere(128, 128, 2.0f, makeChecker(512, 32)) }, 6.0f });
+        }
+        else
+        {
+            std::cerr << "Unknown scene: " << name << std::endl;
+            return 1;
+        }
+    }
+
+    tao::json::value runs = tao::json::empty_array;
+    for(const auto &scene : scenes)
+    {
+        for(const auto &resolution : resolutions)
+        {
+            int width = 0, height = 0;
+            if(std::sscanf(resolution.c_str(), "%dx%d", &width, &height) != 2 ||
+               width <= 0 || height <= 0 || width > 65535 || height > 65535)
+            {
+                std::cerr << "Invalid resolution: " << resolution << std::endl;
+                return 1;
+            }
+
+            std::cerr << scene.name << " " << resolution << std::endl;
+            runs.push_back(run(scene, width, height, Rasterizer::Scanline, 1, false, warmupCount, frameCount));
+            for(const auto &shading : shadings)
+            {
+                for(const auto threadCount : threadCounts)
+                {
+                    runs.push_back(run(scene, width, height, Rasterizer::HalfSpace, threadCount,
+                                       shading == "deferred", warmupCount, frameCount));
+                }
+            }
+        }
+    }
+
+    const tao::json::value results = {
+        { "simd", simdLevelName(detectSimdLevel()) },
+        { "hardware_threads", cores },
+        { "runs", std::move(runs) }
+    };
+
+    if(output.empty())
+    {
+        tao::json::to_stream(std::cout, results, 2);
+        std::cout << std::endl;
+    }
+    else
+    {
+        std::ofstream file(output);
+        tao::json::to_stream(file, results, 2);
+        file << std::endl;
+    }
+    return 0;
+}
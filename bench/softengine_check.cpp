@@ -0,0 +1,318 @@
+// Consistency checks, run by ctest: whatever the instruction set, the number
+// of threads, the tiles or the shading mode, the frames must be the same,
+// pixel for pixel, and edges shared by two triangles drawn exactly once
+
+#include "softengine.h"
+
+#include <glm/gtc/constants.hpp>
+// glm::pi
+
+int g_failures = 0;
+
+void check(bool condition, const std::string &what)
+{
+    if(!condition)
+    {
+        std::cerr << "FAILED: " << what << std::endl;
+        g_failures++;
+    }
+}
+
+const char* rasterizerName(Rasterizer rasterizer)
+{
+    return rasterizer == Rasterizer::HalfSpace ? "halfspace" : "scanline";
+}
+
+// What a frame leaves in the device
+struct Frame
+{
+    std::vector<uint32_t> color;
+    std::vector<float> depth;
+    uint64_t pixels;
+};
+
+struct FrameSettings
+{
+    SimdLevel simd;
+    unsigned threadCount;
+    int tileSize;
+    bool deferredShading;
+
+    std::string name() const
+    {
+        return std::string(simdLevelName(simd)) +
+               ", " + std::to_string(threadCount) + " threads" +
+               ", tiles of " + std::to_string(tileSize) +
+               (deferredShading ? ", deferred" : ", forward");
+    }
+};
+
+Frame renderFrame(const std::vector<Mesh> &meshes, const Camera &camera, const FrameSettings &settings)
+{
+    Device device(320, 240);
+    device.setRasterizer(Rasterizer::HalfSpace);
+    device.setSimdLevel(settings.simd);
+    device.setThreadCount(settings.threadCount);
+    device.setTileSize(settings.tileSize);
+    device.setDeferredShading(settings.deferredShading);
+
+    device.clear({ 0, 0, 0, 255 });
+    device.render(camera, meshes);
+    return { device.colorBuffer(), device.depthBuffer(), device.stats().pixels };
+}
+
+// The half-space rasterizer draws the same frames in all its settings
+void checkSettings(const std::string &scene, const std::vector<Mesh> &meshes)
+{
+    const FrameSettings reference{ SimdLevel::Scalar, 1, 64, false };
+
+    std::vector<FrameSettings> settings;
+    for(const auto simd : { SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2 })
+    {
+        if(simd > detectSimdLevel())
+        {
+            continue;
+        }
+        for(const unsigned threadCount : { 1u, 2u, 4u })
+        {
+            for(const int tileSize : { 16, 64 })
+            {
+                for(const bool deferred : { false, true })
+                {
+                    settings.push_back({ simd, threadCount, tileSize, deferred });
+                }
+            }
+        }
+    }
+
+    // around the scene, slightly above it
+    for(int view = 0; view < 4; view++)
+    {
+        const float angle = 2.0f * glm::pi<float>() * view / 4 + 0.3f;
+        const Camera camera{ { 6.0f * std::sin(angle), 1.5f, -6.0f * std::cos(angle) }, { 0, 0, 0 } };
+
+        const auto expected = renderFrame(meshes, camera, reference);
+        check(expected.pixels > 0, scene + ": nothing drawn");
+        for(const auto &s : settings)
+        {
+            const auto frame = renderFrame(meshes, camera, s);
+            const auto what = scene + ", view " + std::to_string(view) + ", " + s.name();
+            check(frame.color == expected.color, what + ": colors differ");
+            check(frame.depth == expected.depth, what + ": depths differ");
+            check(frame.pixels == expected.pixels, what + ": pixels written differ");
+        }
+    }
+}
+
+Vertex screenVertex(float x, float y)
+{
+    Vertex v{};
+    v.coordinates = glm::vec3(x, y, 0.5f);
+    v.normal = glm::vec3(0.0f, 0.0f, -1.0f);
+    v.clip = glm::vec4(v.coordinates, 1.0f);
+    return v;
+}
+
+// Pixels whose center is in [x0, x1[ x [y0, y1[, as the fill rule draws them
+uint64_t rectanglePixels(float x0, float y0, float x1, float y1)
+{
+    const auto count = [](float a, float b) { return std::ceil(b - 0.5f) - std::ceil(a - 0.5f); };
+    return static_cast<uint64_t>(count(x0, x1) * count(y0, y1));
+}
+
+// Rectangles split into triangles: the pixels along the shared edges are
+// written once, so the pixels written are exactly those of the rectangle
+void checkSharedEdges()
+{
+    // Note: on 1/16 of pixel, and some corners exactly on pixel centers
+    const glm::vec4 rectangles[] = {
+        { 5.3125f, 7.6875f, 40.1875f, 33.9375f },
+        { 10.5f, 10.5f, 20.5f, 20.5f },
+        { 0.0f, 0.0f, 64.0f, 64.0f },
+        { 3.0f, 50.25f, 61.75f, 52.0f },
+    };
+
+    for(const auto rasterizer : { Rasterizer::Scanline, Rasterizer::HalfSpace })
+    {
+        for(const auto simd : { SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2 })
+        {
+            if(simd > detectSimdLevel())
+            {
+                continue;
+            }
+
+            Device device(64, 64);
+            device.setRasterizer(rasterizer);
+            device.setSimdLevel(simd);
+            for(const auto &r : rectangles)
+            {
+                const auto a = screenVertex(r.x, r.y);
+                const auto b = screenVertex(r.z, r.y);
+                const auto c = screenVertex(r.z, r.w);
+                const auto d = screenVertex(r.x, r.w);
+                const auto center = screenVertex(std::floor((r.x * 0.6f + r.z * 0.4f) * 16.0f) / 16.0f,
+                                                 std::floor((r.y * 0.3f + r.w * 0.7f) * 16.0f) / 16.0f);
+
+                // both diagonals, then a fan around an inner point
+                const std::vector<std::array<Vertex, 3>> splits[] = {
+                    { { a, b, c }, { a, c, d } },
+                    { { a, b, d }, { b, c, d } },
+                    { { a, b, center }, { b, c, center }, { c, d, center }, { d, a, center } },
+                };
+                for(size_t split = 0; split < std::size(splits); split++)
+                {
+                    device.clear({ 0, 0, 0, 255 });
+                    const auto before = device.stats().pixels;
+                    for(const auto &t : splits[split])
+                    {
+                        device.drawTriangle(t[0], t[1], t[2], { 255, 255, 255, 255 });
+                    }
+                    device.rasterizeTiles();
+
+                    check(device.stats().pixels - before == rectanglePixels(r.x, r.y, r.z, r.w),
+                          std::string(rasterizerName(rasterizer)) + ", " + simdLevelName(simd) +
+                          ": split " + std::to_string(split) + " of the rectangle (" +
+                          std::to_string(r.x) + ", " + std::to_string(r.y) + ") - (" +
+                          std::to_string(r.z) + ", " + std::to_string(r.w) + ")");
+                }
+            }
+        }
+    }
+}
+
+// Points drawn after a clear are kept when the frame is read back
+void checkPoints()
+{
+    for(const auto rasterizer : { Rasterizer::Scanline, Rasterizer::HalfSpace })
+    {
+        Device device(64, 64);
+        device.setRasterizer(rasterizer);
+        device.clear({ 0, 0, 0, 255 });
+        device.drawPoint({ 5, 5, 0.5f }, { 255, 255, 255, 255 });
+
+        check(device.colorBuffer()[5 + 5*64] == toRGBA8888({ 255, 255, 255, 255 }),
+              std::string(rasterizerName(rasterizer)) + ": point drawn after a clear");
+    }
+}
+
+// A truncated mesh cache is rejected then rebuilt, and a mesh whose faces
+// are out of its vertices fails to load (and is never cached)
+void checkMeshCache(const std::string &dataDirectory)
+{
+    namespace fs = std::filesystem;
+    const auto directory = fs::temp_directory_path() / "softengine_check";
+    fs::remove_all(directory);
+    fs::create_directories(directory);
+
+    const auto source = (directory / "cube.babylon").string();
+    const auto cache = source + ".meshcache";
+    fs::copy_file(dataDirectory + "/cube.babylon", source);
+
+    std::vector<Mesh> meshes;
+    const auto expected = loadCachedMesh(source);
+    check(loadMeshCache(cache, source, {}, meshes), "mesh cache written");
+
+    fs::resize_file(cache, fs::file_size(cache) / 2);
+    check(!loadMeshCache(cache, source, {}, meshes), "truncated mesh cache rejected");
+
+    const auto rebuilt = loadCachedMesh(source);
+    check(rebuilt.size() == expected.size() && rebuilt[0].vertices.size() == expected[0].vertices.size(),
+          "mesh loaded again from a truncated mesh cache");
+    check(loadMeshCache(cache, source, {}, meshes), "truncated mesh cache rebuilt");
+
+    // the first face of the cube pointing far after its 8 vertices
+    std::ifstream in(dataDirectory + "/cube.babylon");
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const std::string indices = "\"indices\":[0,";
+    text.replace(text.find(indices), indices.size(), "\"indices\":[200,");
+
+    const auto invalid = (directory / "invalid.babylon").string();
+    std::ofstream(invalid) << text;
+    bool failed = false;
+    try
+    {
+        loadCachedMesh(invalid);
+    }
+    catch(const std::exception &)
+    {
+        failed = true;
+    }
+    check(failed, "mesh with faces out of its vertices rejected");
+    check(!fs::exists(invalid + ".meshcache"), "mesh with faces out of its vertices not cached");
+
+    fs::remove_all(directory);
+}
+
+// The texture of a mesh is found next to its .babylon file, whatever the
+// current directory, when the mesh is parsed or read from its cache
+void checkTexturePaths()
+{
+    namespace fs = std::filesystem;
+    const auto directory = fs::temp_directory_path() / "softengine_check";
+    fs::remove_all(directory);
+    fs::create_directories(directory / "scene");
+
+    // a textured triangle, and its 2x2 pixels texture
+    std::ofstream(directory / "scene" / "triangle.babylon") <<
+        R"({"materials":[{"id":"m","backFaceCulling":true,"diffuseTexture":{"name":"texture.ppm"}}],)"
+        R"("meshes":[{"materialId":"m","uvCount":1,"indices":[0,1,2],"vertices":[)"
+        R"(0,0,0, 0,0,-1, 0,0, 1,0,0, 0,0,-1, 1,0, 0,1,0, 0,0,-1, 0,1]}]})";
+    std::ofstream(directory / "scene" / "texture.ppm", std::ios::binary) <<
+        "P6\n2 2\n255\n" << std::string(12, '\x80');
+
+    const auto current = fs::current_path();
+    const auto load = [](const std::string &filename, const std::string &what)
+    {
+        const auto meshes = loadCachedMesh(filename);
+        check(meshes.size() == 1 && meshes[0].textureFile == "texture.ppm" && meshes[0].texture,
+              "texture of " + filename + ", " + what);
+    };
+
+    fs::current_path(directory);
+    load("scene/triangle.babylon", "parsed");
+    fs::current_path(directory / "scene");
+    load("triangle.babylon", "from the mesh cache");
+    fs::remove("triangle.babylon.meshcache");
+    load("triangle.babylon", "parsed");
+    fs::current_path(directory);
+    load("scene/triangle.babylon", "from the mesh cache");
+
+    fs::current_path(current);
+    fs::remove_all(directory);
+}
+
+// Usage: softengine_check [--data directory]
+//   --data  directory of the .babylon files (default: data)
+// Returns 1 when any check fails
+int main(int argc, char **argv)
+{
+    std::string dataDirectory = "data";
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if(arg == "--data" && i+1 < argc)
+            dataDirectory = argv[++i];
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    for(const auto scene : { "cube", "monkey" })
+    {
+        checkSettings(scene, loadJsonMesh(dataDirectory + "/" + scene + ".babylon"));
+    }
+    checkSharedEdges();
+    checkPoints();
+    checkMeshCache(dataDirectory);
+    checkTexturePaths();
+
+    if(g_failures > 0)
+    {
+        std::cerr << g_failures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cerr << "All checks passed" << std::endl;
+    return 0;
+}
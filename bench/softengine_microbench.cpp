@@ -0,0 +1,417 @@
+// Kernel level benchmark: runs each stage of the pipeline alone, on synthetic
+// inputs, and reports the time per operation & the memory it moves as JSON
+
+#include "softengine.h"
+
+#include <glm/gtc/constants.hpp>
+// glm::pi
+
+#include <random>
+
+// Keeps the compiler from optimizing the benchmarked code away
+volatile float g_sink;
+
+// Best time per operation (ns) over a few runs of at least minMs each,
+// f() doing opsPerCall operations
+template<typename F>
+double nsPerOp(size_t opsPerCall, double minMs, F f)
+{
+    double best = std::numeric_limits<double>::max();
+    for(int run = 0; run < 5; run++)
+    {
+        size_t calls = 0;
+        const auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::milli> elapsed{0};
+        do
+        {
+            f();
+            calls++;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        while(elapsed.count() < minMs);
+
+        best = std::min(best, elapsed.count() * 1e6 / (calls * opsPerCall));
+    }
+    return best;
+}
+
+// Equilateral triangles with sides of size pixels, randomly placed & oriented
+// on a width x height screen
+std::vector<Vertex> makeTriangles(size_t count, float size, int width, int height, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Vertex> vertices;
+    for(size_t i = 0; i < count; i++)
+    {
+        const glm::vec2 center(size + unit(rng) * (width - 2*size), size + unit(rng) * (height - 2*size));
+        const float angle = unit(rng) * 2.0f * glm::pi<float>();
+        for(int v = 0; v < 3; v++)
+        {
+            const float a = angle + v * 2.0f * glm::pi<float>() / 3.0f;
+            Vertex vertex{};
+            vertex.coordinates = glm::vec3(center.x + std::cos(a) * size / std::sqrt(3.0f),
+                                           center.y + std::sin(a) * size / std::sqrt(3.0f),
+                                           0.5f + 0.1f * unit(rng));
+            vertex.worldCoordinates = glm::vec3(unit(rng), unit(rng), unit(rng));
+            vertex.normal = glm::vec3(0.0f, 0.0f, -1.0f);
+            vertex.clip = glm::vec4(vertex.coordinates, 1.0f);
+            vertices.push_back(vertex);
+        }
+    }
+    return vertices;
+}
+
+VertexStreams makeVertices(size_t count, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> coordinate(-1.0f, 1.0f);
+    VertexStreams vertices;
+    vertices.resize(count, false);
+    for(size_t i = 0; i < count; i++)
+    {
+        vertices.x[i] = coordinate(rng);
+        vertices.y[i] = coordinate(rng);
+        vertices.z[i] = coordinate(rng);
+        const auto n = glm::normalize(glm::vec3(coordinate(rng), coordinate(rng), coordinate(rng)) + glm::vec3(0.0f, 0.0f, 2.0f));
+        vertices.nx[i] = n.x;
+        vertices.ny[i] = n.y;
+        vertices.nz[i] = n.z;
+    }
+    return vertices;
+}
+
+// Usage: softengine_microbench [--filter text] [--min-time ms] [--output results.json]
+//   --filter    only runs the kernels whose name contains the text
+//   --min-time  minimum duration of each of the 5 runs of a measure (default: 20 ms)
+//   --output    writes the JSON results to a file instead of the standard output
+// Note: bytes_per_op only counts the frame & vertex memory a kernel reads and
+// writes, as if nothing was in cache
+int main(int argc, char **argv)
+{
+    std::string filter;
+    double minMs = 20.0;
+    std::string output;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if(arg == "--filter" && i+1 < argc)
+            filter = argv[++i];
+        else if(arg == "--min-time" && i+1 < argc)
+            minMs = std::stod(argv[++i]);
+        else if(arg == "--output" && i+1 < argc)
+            output = argv[++i];
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    constexpr int width = 640;
+    constexpr int height = 480;
+    std::mt19937 rng(1234);
+    tao::json::value results = tao::json::empty_array;
+
+    const auto report = [&](const std::string &kernel, const std::string &input,
+                            double ns, double bytesPerOp)
+    {
+        std::cerr << kernel << " " << input << ": " << ns << " ns/op" << std::endl;
+        results.push_back({
+            { "kernel", kernel },
+            { "input", input },
+            { "ns_per_op", ns },
+            { "bytes_per_op", bytesPerOp },
+            { "gb_per_second", bytesPerOp / ns }
+        });
+    };
+    const auto enabled = [&](const std::string &kernel)
+    {
+        return kernel.find(filter) != std::string::npos;
+    };
+
+    const glm::mat4x4 mvMat = glm::lookAtLH(glm::vec3(0, 0, -5), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+    const glm::mat4x4 projMat = glm::perspectiveFovLH(0.78f, float(width), float(height), 0.01f, 1.0f);
+    const auto vertexTransform = makeVertexTransform(mvMat, projMat, width, height);
+
+    // Vertex stage, one vertex per operation
+    // reads: position & normal (6 floats), writes: one Vertex
+    const double vertexBytes = 6 * sizeof(float) + sizeof(Vertex);
+    for(const size_t count : { 64, 1024, 16384 })
+    {
+        const auto input = std::to_string(count) + " vertices";
+        const auto in = makeVertices(count, rng);
+        std::vector<Vertex> out(count);
+
+        if(enabled("project"))
+        {
+            Device device(width, height);
+            const auto ns = nsPerOp(count, minMs, [&]
+            {
+                for(size_t i = 0; i < count; i++)
+                {
+                    out[i] = device.project(in.position(i), in.normal(i), mvMat, projMat);
+                }
+                g_sink = out[count / 2].coordinates.x;
+            });
+            report("project", input, ns, vertexBytes);
+        }
+
+        for(const auto simd : { SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2 })
+        {
+            const std::string kernel = std::string("transformVertices/") + simdLevelName(simd);
+            if(simd > detectSimdLevel() || !enabled(kernel))
+            {
+                continue;
+            }
+            const auto ns = nsPerOp(count, minMs, [&]
+            {
+                transformVertices(in, vertexTransform, out.data(), simd);
+                g_sink = out[count / 2].coordinates.x;
+            });
+            report(kernel, input, ns, vertexBytes);
+        }
+    }
+
+    // Flat shading, one face per operation
+    if(enabled("computeNDotL"))
+    {
+        Device device(width, height);
+        const auto vertices = makeTriangles(1024, 16.0f, width, height, rng);
+        const auto ns = nsPerOp(vertices.size(), minMs, [&]
+        {
+            float sum = 0;
+            for(const auto &v : vertices)
+            {
+                sum += device.computeNDotL(v.worldCoordinates, v.normal, glm::vec3(0, 10, 10));
+            }
+            g_sink = sum;
+        });
+        report("computeNDotL", std::to_string(vertices.size()) + " faces", ns, 0);
+    }
+
+    // Triangles of controlled sizes, one triangle per operation
+    for(const float size : { 2.0f, 8.0f, 32.0f, 128.0f })
+    {
+        constexpr size_t count = 1024;
+        const auto input = std::to_string(count) + " triangles, sides of " + std::to_string(int(size)) + " px";
+        const auto vertices = makeTriangles(count, size, width, height, rng);
+        // an equilateral triangle of side s covers s² * sqrt(3)/4 pixels;
+        // each one: depth read & write, color write
+        const double pixelBytes = 2 * sizeof(float) + sizeof(uint32_t);
+        const double triangleBytes = std::sqrt(3.0f) / 4 * size * size * pixelBytes;
+
+        std::vector<TriangleSetup> setups(count);
+        if(enabled("setupTriangle"))
+        {
+            Device device(width, height);
+            const auto ns = nsPerOp(count, minMs, [&]
+            {
+                for(size_t i = 0; i < count; i++)
+                {
+                    device.setupTriangle(vertices[3*i], vertices[3*i+1], vertices[3*i+2], glm::vec3(1.0f), { 255, 255, 255, 255 }, setups[i]);
+                }
+                g_sink = setups[count / 2].z0;
+            });
+            report("setupTriangle", input, ns, 3 * sizeof(glm::vec3) + sizeof(TriangleSetup));
+        }
+
+        if(enabled("drawTriangle/scanline"))
+        {
+            Device device(width, height);
+            device.setRasterizer(Rasterizer::Scanline);
+            device.clear({ 0, 0, 0, 255 });
+            const auto ns = nsPerOp(count, minMs, [&]
+            {
+                for(size_t i = 0; i < count; i++)
+                {
+                    device.drawTriangle(vertices[3*i], vertices[3*i+1], vertices[3*i+2], { 255, 255, 255, 255 });
+                }
+            });
+            report("drawTriangle/scanline", input, ns, triangleBytes);
+        }
+
+        for(const auto simd : { SimdLevel::Scalar, SimdLevel::SSE41, SimdLevel::AVX2 })
+        {
+            const std::string kernel = std::string("rasterize/") + simdLevelName(simd);
+            if(simd > detectSimdLevel() || !enabled(kernel))
+            {
+                continue;
+            }
+
+            Device device(width, height);
+            for(size_t i = 0; i < count; i++)
+            {
+                device.setupTriangle(vertices[3*i], vertices[3*i+1], vertices[3*i+2], glm::vec3(1.0f), { 255, 255, 255, 255 }, setups[i]);
+            }
+
+            std::vector<uint32_t> color(width * height, 0);
+            std::vector<float> depth(width * height, std::numeric_limits<float>::max());
+            std::vector<float> hizMin((width / hizBlockSize) * (height / hizBlockSize), std::numeric_limits<float>::max());
+            std::vector<float> hizMax(hizMin.size(), std::numeric_limits<float>::max());
+            uint64_t shadedPixels = 0;
+            const RenderTarget rt{ color.data(), nullptr, depth.data(), width, height,
+                                   hizMin.data(), hizMax.data(), width / hizBlockSize, &shadedPixels };
+
+            const auto ns = nsPerOp(count, minMs, [&]
+            {
+                for(const auto &t : setups)
+                {
+                    rasterize(t, rt, simd);
+                }
+            });
+            report(kernel, input, ns, triangleBytes);
+        }
+    }
+
+    // Spans of controlled widths, one span per operation
+    // each pixel: depth read & write, color write
+    for(const int spanWidth : { 8, 64, 512 })
+    {
+        const auto kernel = "processScanline";
+        if(!enabled(kernel))
+        {
+            break;
+        }
+
+        Device device(width, height);
+        device.clear({ 0, 0, 0, 255 });
+        device.depthBuffer(); // the clear is resolved once, outside of the measure
+
+        Vertex left{}, right{};
+        left.coordinates  = glm::vec3(10.0f, 0.0f, 0.5f);
+        right.coordinates = glm::vec3(10.0f + spanWidth, 0.0f, 0.6f);
+        const auto ns = nsPerOp(height, minMs, [&]
+        {
+            for(int y = 0; y < height; y++)
+            {
+                left.coordinates.y = right.coordinates.y = y + 0.5f;
+                device.processScanline({ y, { 0.0f, 0.0f, 1.0f }, { 0.1f / spanWidth, 0.0f, 0.5f }, {} },
+                                       left, left, right, right, { 255, 255, 255, 255 });
+            }
+        });
+        report(kernel, std::to_string(spanWidth) + " px spans", ns,
+               spanWidth * (2 * sizeof(float) + sizeof(uint32_t)));
+    }
+
+    // Textured pixels, one pixel per operation: a square of 64x64 pixels,
+    // rotated on a 512x512 noise texture, magnified, 1:1 & minified
+    // (then sampled on the mipmap level whose texels match the pixels)
+    // reads: the 4 texels of the bilinear filter
+    {
+        constexpr int size = 512;
+        std::uniform_int_distribution<uint32_t> noise;
+        std::vector<uint32_t> pixels(size * size);
+        for(auto &p : pixels)
+        {
+            p = noise(rng);
+        }
+        const Texture texture(size, size, pixels.data());
+
+        for(const float texelsPerPixel : { 0.25f, 1.0f, 4.0f })
+        {
+            const float angle = 0.5f;
+            const float scale = texelsPerPixel / size;
+            TextureMapping mapping{ &texture,
+                                    { std::cos(angle) * scale, -std::sin(angle) * scale, 0.1f },
+                                    { std::sin(angle) * scale,  std::cos(angle) * scale, 0.2f },
+                                    { 0.0f, 0.0f, 1.0f } };
+
+            for(const auto simd : { SimdLevel::Scalar, SimdLevel::SSE41 })
+            {
+                const std::string kernel = std::string("shadeTexel/") + simdLevelName(simd);
+                if(simd > detectSimdLevel() || !enabled(kernel))
+                {
+                    continue;
+                }
+                const auto ns = nsPerOp(64 * 64, minMs, [&]
+                {
+                    uint32_t sum = 0;
+                    for(int y = 0; y < 64; y++)
+                    {
+                        for(int x = 0; x < 64; x++)
+                        {
+                            sum += shadeTexel(mapping, x, y, 1.0f, simd);
+                        }
+                    }
+                    g_sink = static_cast<float>(sum);
+                });
+                report(kernel, std::to_string(texelsPerPixel) + " texels per pixel", ns, 4 * sizeof(uint32_t));
+            }
+        }
+    }
+
+    // Single pixels, sequential & random, one pixel per operation
+    if(enabled("putPixel"))
+    {
+        Device device(width, height);
+        device.clear({ 0, 0, 0, 255 });
+        device.depthBuffer();
+
+        std::vector<glm::vec3> sequential, random;
+        std::uniform_int_distribution<int> x(0, width - 1), y(0, height - 1);
+        for(int i = 0; i < width * height; i++)
+        {
+            sequential.emplace_back(i % width, i / width, 0.5f);
+            random.emplace_back(x(rng), y(rng), 0.5f);
+        }
+
+        for(const auto *points : { &sequential, &random })
+        {
+            const auto ns = nsPerOp(points->size(), minMs, [&]
+            {
+                for(const auto &p : *points)
+                {
+                    device.drawPoint(p, { 255, 255, 255, 255 });
+                }
+            });
+            report("putPixel", points == &sequential ? "sequential" : "random", ns,
+                   2 * sizeof(float) + sizeof(uint32_t));
+        }
+    }
+
+    // Whole frame clears, one clear per operation: the clear itself (flags
+    // only), and followed by the resolve a frame with nothing drawn needs
+    if(enabled("clear"))
+    {
+        for(const auto &size : { std::make_pair(640, 480), std::make_pair(1920, 1080) })
+        {
+            Device device(size.first, size.second);
+            const auto input = std::to_string(size.first) + "x" + std::to_string(size.second);
+
+            const auto clearNs = nsPerOp(1, minMs, [&]
+            {
+                device.clear({ 0, 0, 0, 255 });
+            });
+            report("clear", input, clearNs, 0);
+
+            // alternating colors, so that the resolve really writes the frame
+            uint8_t shade = 0;
+            const auto resolveNs = nsPerOp(1, minMs, [&]
+            {
+                device.clear({ shade++, 0, 0, 255 });
+                g_sink = device.colorBuffer()[0];
+            });
+            report("clear+resolve", input, resolveNs, size.first * size.second * sizeof(uint32_t));
+        }
+    }
+
+    const tao::json::value json = {
+        { "simd", simdLevelName(detectSimdLevel()) },
+        { "width", width },
+        { "height", height },
+        { "results", std::move(results) }
+    };
+
+    if(output.empty())
+    {
+        tao::json::to_stream(std::cout, json, 2);
+        std::cout << std::endl;
+    }
+    else
+    {
+        std::ofstream file(output);
+        tao::json::to_stream(file, json, 2);
+        file << std::endl;
+    }
+    return 0;
+}
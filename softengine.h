@@ -0,0 +1,4921 @@
+// softengine: a software 3D rendering engine, SDL & GLM based
+// Note: header only, included by the softengine executable (main.cpp)
+// and by the benchmarks (bench/)
+#ifndef SOFTENGINE_H
+#define SOFTENGINE_H
+
+#include <stdint.h>
+
+// GLM includes:
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/matrix.hpp>
+// glm::inverse, glm::transpose
+#include <glm/gtc/matrix_transform.hpp>
+// glm::translate, glm::rotate, glm::perspective
+
+// Taocpp/json includes:
+#include <tao/json.hpp>
+#include <tao/json/contrib/traits.hpp>
+// Note: documentation at https://github.com/taocpp/json/blob/master/doc/Common-Use-Cases.md
+
+// Libstd includes;
+#include <limits>   // std::numeric_limits
+#include <cmath>    // std::abs, std::lerp
+#include <cstring>  // std::memcpy
+#include <algorithm> // std::fill
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem> // std::filesystem::last_write_time
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>   // std::unique_ptr
+#include <mutex>
+#include <queue>    // std::priority_queue
+#include <stdexcept> // std::runtime_error
+#include <new>      // std::align_val_t
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <array>
+#include <vector>
+
+// SIMD includes:
+// Note: the SIMD kernels are compiled with per function target attributes
+// and selected at runtime, so the executable still runs on any x86 CPU
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SOFTENGINE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// Memory mapping includes:
+// Note: elsewhere, mesh cache files are read into memory instead of mapped
+#if defined(__unix__) || defined(__APPLE__)
+#define SOFTENGINE_MMAP
+#include <fcntl.h>      // open
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close
+#endif
+
+// SDL includes:
+// Note: SDL is optional, without it the engine can only render offscreen
+// (see SOFTENGINE_WITH_SDL in CMakeLists.txt)
+#ifdef SOFTENGINE_WITH_SDL
+#include <SDL2/SDL.h>
+// Note: SDL documentation for each function name at:
+// https://wiki.libsdl.org/SDL_CreateRenderer
+//                         ^^^^^^^^^^^^^^^^^^ function name
+#endif
+
+// Inspired from:
+// https://www.davrous.com/2013/06/13/tutorial-series-learning-how-to-write-a-3d-soft-engine-from-scratch-in-c-typescript-or-javascript/
+// https://www.opengl-tutorial.org/beginners-tutorials/tutorial-3-matrices/
+// https://open.gl/transformations
+
+// RGBA_8888 = 32 bits / pixel
+struct color4
+{
+    uint8_t r;  // red
+    uint8_t g;  // green
+    uint8_t b;  // blue
+    uint8_t a;  // alpha
+};
+
+// Packs a color the way SDL_PIXELFORMAT_RGBA8888 expects it:
+// one 32 bits word with red in the most significant byte
+constexpr uint32_t toRGBA8888(color4 c)
+{
+    return (static_cast<uint32_t>(c.r) << 24) |
+           (static_cast<uint32_t>(c.g) << 16) |
+           (static_cast<uint32_t>(c.b) <<  8) |
+            static_cast<uint32_t>(c.a);
+}
+
+// And unpacks it back
+constexpr color4 fromRGBA8888(uint32_t c)
+{
+    return {
+        static_cast<uint8_t>(c >> 24),
+        static_cast<uint8_t>(c >> 16),
+        static_cast<uint8_t>(c >>  8),
+        static_cast<uint8_t>(c)
+    };
+}
+
+struct Camera
+{
+    glm::vec3 position;
+    glm::vec3 target;
+};
+
+template<typename Index>
+struct BasicFace
+{
+    Index a;
+    Index b;
+    Index c;
+};
+using Face16 = BasicFace<uint16_t>;
+using Face32 = BasicFace<uint32_t>;
+
+// A vertex once projected by Device::project
+struct Vertex
+{
+    glm::vec3 coordinates;
+    glm::vec3 worldCoordinates; // 3D projected coordinates
+    glm::vec3 normal;           // vertex normal for Gouraud shading
+    glm::vec4 clip;             // screen coordinates before the perspective divide,
+                                // where triangles are clipped (see Device::clipCode)
+    glm::vec2 uv;               // texture coordinates (0, 0 when the mesh has none)
+};
+
+// Allocates memory aligned for SIMD loads (e.g. 32 bytes for AVX)
+template<typename T, std::size_t Alignment>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    template<typename U>
+    struct rebind { using other = AlignedAllocator<U, Alignment>; };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) { }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+// An array of mesh data: either allocated (32 bytes aligned & zeroed),
+// or a view of memory owned by someone else, e.g. a mapped mesh cache file
+// (see loadMeshCache), which is kept alive as long as the view is used.
+// Note: copies share the same memory, so copying a mesh is cheap
+// and its copies must not be modified
+template<typename T>
+class MeshBuffer
+{
+public:
+    MeshBuffer() = default;
+
+    explicit MeshBuffer(size_t count)
+        : m_storage(AlignedAllocator<T, 32>().allocate(std::max<size_t>(count, 1)),
+                    [](void *p) { AlignedAllocator<T, 32>().deallocate(static_cast<T*>(p), 0); })
+        , m_data(static_cast<T*>(m_storage.get()))
+        , m_size(count)
+    {
+        std::fill_n(m_data, count, T{});
+    }
+
+    MeshBuffer(std::shared_ptr<void> storage, T *data, size_t count)
+        : m_storage(std::move(storage))
+        , m_data(data)
+        , m_size(count)
+    {
+    }
+
+    const std::shared_ptr<void>& storage() const { return m_storage; }
+
+    T* data() { return m_data; }
+    const T* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    T& operator[](size_t i) { return m_data[i]; }
+    const T& operator[](size_t i) const { return m_data[i]; }
+
+    T* begin() { return m_data; }
+    T* end() { return m_data + m_size; }
+    const T* begin() const { return m_data; }
+    const T* end() const { return m_data + m_size; }
+
+private:
+    std::shared_ptr<void> m_storage;
+    T *m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// Vertices of a mesh, stored as one array per component (structure of arrays):
+// each stage only reads the components it needs, and 8 consecutive vertices
+// fill exactly one AVX register.
+// Note: streams are 32 bytes aligned and zero padded to a multiple of 8 floats,
+// so SIMD loops never need a scalar tail
+struct VertexStreams
+{
+    using Stream = MeshBuffer<float>;
+    static constexpr size_t padding = 8;
+
+    Stream x, y, z;     // positions
+    Stream nx, ny, nz;  // normals
+    Stream u, v;        // texture coordinates, empty when the mesh has none
+
+    size_t size() const { return m_count; }
+    bool hasUV() const { return !u.empty(); }
+
+    // Floats in each stream of count vertices
+    static size_t paddedSize(size_t count) { return (count + padding - 1) / padding * padding; }
+
+    // The streams, in the order they are laid out by setStreams
+    std::vector<const Stream*> streams() const
+    {
+        if(hasUV())
+        {
+            return { &x, &y, &z, &nx, &ny, &nz, &u, &v };
+        }
+        return { &x, &y, &z, &nx, &ny, &nz };
+    }
+
+    // Allocates all the streams in one block
+    void resize(size_t count, bool withUV)
+    {
+        Stream block(paddedSize(count) * (withUV ? 8 : 6));
+        setStreams(block.storage(), block.data(), count, withUV);
+    }
+
+    // Uses the streams laid out one after the other at data,
+    // each of paddedSize(count) floats
+    void setStreams(const std::shared_ptr<void> &storage, float *data, size_t count, bool withUV)
+    {
+        m_count = count;
+        const auto padded = paddedSize(count);
+        Stream* streams[] = { &x, &y, &z, &nx, &ny, &nz, &u, &v };
+        for(size_t i = 0; i < 8; i++)
+        {
+            *streams[i] = (i < 6 || withUV) ? Stream(storage, data + i*padded, padded) : Stream();
+        }
+    }
+
+    glm::vec3 position(size_t i) const { return { x[i], y[i], z[i] }; }
+    glm::vec3 normal(size_t i) const { return { nx[i], ny[i], nz[i] }; }
+
+private:
+    size_t m_count = 0;
+};
+
+// Bounding volumes of a mesh, in object space
+struct Bounds
+{
+    glm::vec3 min;      // axis aligned bounding box
+    glm::vec3 max;
+    glm::vec3 center;   // bounding sphere
+    float radius;
+};
+
+inline Bounds computeBounds(const VertexStreams &vertices)
+{
+    Bounds bounds{ glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f), 0.0f };
+    if(vertices.size() == 0)
+    {
+        return bounds;
+    }
+
+    bounds.min = bounds.max = vertices.position(0);
+    for(size_t i = 1; i < vertices.size(); i++)
+    {
+        bounds.min = glm::min(bounds.min, vertices.position(i));
+        bounds.max = glm::max(bounds.max, vertices.position(i));
+    }
+
+    // the sphere is centered on the box, its radius reaches the farthest vertex
+    bounds.center = (bounds.min + bounds.max) * 0.5f;
+    for(size_t i = 0; i < vertices.size(); i++)
+    {
+        bounds.radius = std::max(bounds.radius, glm::length(vertices.position(i) - bounds.center));
+    }
+
+    return bounds;
+}
+
+// Faces of a mesh: with 16 bits indices when the mesh has at most 65536
+// vertices (half the memory of 32 bits indices), with 32 bits indices beyond.
+// Only one of the two buffers is used.
+struct FaceBuffer
+{
+    MeshBuffer<Face16> faces16;
+    MeshBuffer<Face32> faces32;
+
+    bool hasIndices32() const { return !faces32.empty(); }
+    size_t size() const { return faces16.size() + faces32.size(); }
+    size_t indexSize() const { return hasIndices32() ? sizeof(uint32_t) : sizeof(uint16_t); }
+
+    // Calls f with the buffer holding the faces, so that f can be
+    // instantiated for each type of index
+    template<typename F>
+    void visit(F f) const
+    {
+        if(hasIndices32())
+        {
+            f(faces32);
+        }
+        else
+        {
+            f(faces16);
+        }
+    }
+};
+
+// Faces of a mesh of vertexCount vertices, from their indices (3 per face)
+inline FaceBuffer makeFaces(const std::vector<uint32_t> &indices, size_t vertexCount)
+{
+    const auto fill = [&](auto &faces)
+    {
+        using Index = decltype(faces[0].a);
+        for(size_t i = 0; i < faces.size(); i++)
+        {
+            faces[i] = {
+                static_cast<Index>(indices[i * 3]),
+                static_cast<Index>(indices[i * 3 + 1]),
+                static_cast<Index>(indices[i * 3 + 2])
+            };
+        }
+    };
+
+    FaceBuffer buffer;
+    if(vertexCount > 65536)
+    {
+        buffer.faces32 = MeshBuffer<Face32>(indices.size() / 3);
+        fill(buffer.faces32);
+    }
+    else
+    {
+        buffer.faces16 = MeshBuffer<Face16>(indices.size() / 3);
+        fill(buffer.faces16);
+    }
+    return buffer;
+}
+
+// Indices of the faces (3 per face), whatever their type
+inline std::vector<uint32_t> faceIndices(const FaceBuffer &buffer)
+{
+    std::vector<uint32_t> indices;
+    indices.reserve(buffer.size() * 3);
+    buffer.visit([&](const auto &faces)
+    {
+        for(const auto face : faces)
+        {
+            indices.insert(indices.end(), { face.a, face.b, face.c });
+        }
+    });
+    return indices;
+}
+
+// Texture, as RGBA_8888 texels (see toRGBA8888), with its whole chain of
+// mipmaps: each level is half the size of the previous one (rounded down),
+// down to 1x1, each of its texels the average of 2x2 texels of the previous one.
+// Texels are stored by tiles of 4x4 texels (64 bytes: one cache line), line
+// by line inside a tile, and the tiles line by line inside a level. The 4
+// texels of a bilinear sample are mostly in the same cache line, and a
+// triangle walked along X or along Y on screen reads the texture along
+// any direction with as few cache lines as possible.
+// Note: like the meshes, textures are never modified once created
+class Texture
+{
+public:
+    static constexpr int tileSize = 4;
+
+    // pixels: width x height texels, line by line from the top
+    Texture(int width, int height, const uint32_t *pixels)
+    {
+        // the levels' sizes & where their tiles start
+        size_t offset = 0;
+        for(int w = width, h = height; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
+        {
+            const int tilesX = (w + tileSize - 1) / tileSize;
+            const int tilesY = (h + tileSize - 1) / tileSize;
+            m_levels.push_back({ w, h, tilesX, offset });
+            offset += static_cast<size_t>(tilesX) * tilesY * tileSize * tileSize;
+            if(w == 1 && h == 1)
+            {
+                break;
+            }
+        }
+        m_texels.resize(offset, 0);
+
+        for(int y = 0; y < height; y++)
+        {
+            for(int x = 0; x < width; x++)
+            {
+                m_texels[index(0, x, y)] = pixels[x + static_cast<size_t>(y) * width];
+            }
+        }
+
+        // box filter, channel by channel, rounded to the nearest
+        // Note: on odd sizes, the last line & column are only filtered
+        // with their neighbour
+        for(int level = 1; level < levelCount(); level++)
+        {
+            const auto &previous = m_levels[level - 1];
+            for(int y = 0; y < levelHeight(level); y++)
+            {
+                for(int x = 0; x < levelWidth(level); x++)
+                {
+                    const int x0 = std::min(2 * x, previous.width - 1);
+                    const int y0 = std::min(2 * y, previous.height - 1);
+                    const int x1 = std::min(2 * x + 1, previous.width - 1);
+                    const int y1 = std::min(2 * y + 1, previous.height - 1);
+                    const uint32_t quad[4] = { texel(level - 1, x0, y0), texel(level - 1, x1, y0),
+                                               texel(level - 1, x0, y1), texel(level - 1, x1, y1) };
+                    uint32_t average = 0;
+                    for(int shift = 0; shift < 32; shift += 8)
+                    {
+                        uint32_t sum = 2;
+                        for(const auto t : quad)
+                        {
+                            sum += (t >> shift) & 0xff;
+                        }
+                        average |= (sum / 4) << shift;
+                    }
+                    m_texels[index(level, x, y)] = average;
+                }
+            }
+        }
+    }
+
+    int width() const { return m_levels[0].width; }
+    int height() const { return m_levels[0].height; }
+
+    int levelCount() const { return static_cast<int>(m_levels.size()); }
+    int levelWidth(int level) const { return m_levels[level].width; }
+    int levelHeight(int level) const { return m_levels[level].height; }
+
+    // Texel (x, y) of a level, with x & y inside the level
+    uint32_t texel(int level, int x, int y) const { return m_texels[index(level, x, y)]; }
+
+    // The same, split for the samplers: texel (x, y) of a level is
+    // levelTexels(level)[columnOffset(x) + lineOffset(level, y)]
+    const uint32_t* levelTexels(int level) const { return m_texels.data() + m_levels[level].offset; }
+    static size_t columnOffset(unsigned x) { return (x / tileSize) * tileSize * tileSize + x % tileSize; }
+    size_t lineOffset(int level, unsigned y) const
+    {
+        return (y / tileSize) * m_levels[level].tilesX * tileSize * tileSize + (y % tileSize) * tileSize;
+    }
+
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        int tilesX;     // number of tiles per line
+        size_t offset;  // of its first tile, in texels
+    };
+
+    size_t index(int level, int x, int y) const
+    {
+        return m_levels[level].offset + columnOffset(x) + lineOffset(level, y);
+    }
+
+    std::vector<Level> m_levels;
+    std::vector<uint32_t, AlignedAllocator<uint32_t, 64>> m_texels;
+};
+
+// Value of a linear function of the screen, at the center of pixel (x, y):
+// v(x,y) = dx*x + dy*y + c0
+struct ScreenPlane
+{
+    float dx;
+    float dy;
+    float c0;
+
+    float at(int x, int y) const { return dx * x + dy * y + c0; }
+};
+
+// The plane through the values a1, a2 & a3 at the screen points p1, p2 & p3
+// Note: flat (a1 everywhere) when the triangle is degenerated
+inline ScreenPlane screenPlane(const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3,
+                               float a1, float a2, float a3)
+{
+    const double x12 = p2.x - p1.x, y12 = p2.y - p1.y;
+    const double x13 = p3.x - p1.x, y13 = p3.y - p1.y;
+    const double area = x12 * y13 - x13 * y12;
+    if(area == 0)
+    {
+        return { 0.0f, 0.0f, a1 };
+    }
+
+    const double da12 = a2 - a1, da13 = a3 - a1;
+    const double dx = (da12 * y13 - da13 * y12) / area;
+    const double dy = (da13 * x12 - da12 * x13) / area;
+    return {
+        static_cast<float>(dx),
+        static_cast<float>(dy),
+        static_cast<float>(a1 + dx * (0.5 - p1.x) + dy * (0.5 - p1.y))
+    };
+}
+
+// Perspective-correct texture mapping: u & v are not linear on screen, but
+// u/w, v/w & 1/w are, so those are interpolated, and u & v are divided back
+// by 1/w at each pixel. w is the depth of the vertex in view space (the W of
+// its clip coordinates).
+struct TextureMapping
+{
+    const Texture *texture;     // nullptr when the triangle is not textured
+    ScreenPlane uOverW;
+    ScreenPlane vOverW;
+    ScreenPlane oneOverW;
+};
+
+inline TextureMapping textureMapping(const Vertex &v1, const Vertex &v2, const Vertex &v3, const Texture *texture)
+{
+    const auto &p1 = v1.coordinates;
+    const auto &p2 = v2.coordinates;
+    const auto &p3 = v3.coordinates;
+    const float q1 = 1.0f / v1.clip.w;
+    const float q2 = 1.0f / v2.clip.w;
+    const float q3 = 1.0f / v3.clip.w;
+    return {
+        texture,
+        screenPlane(p1, p2, p3, v1.uv.x * q1, v2.uv.x * q2, v3.uv.x * q3),
+        screenPlane(p1, p2, p3, v1.uv.y * q1, v2.uv.y * q2, v3.uv.y * q3),
+        screenPlane(p1, p2, p3, q1, q2, q3)
+    };
+}
+
+// A coarser version of a mesh (see buildLods)
+struct MeshLod
+{
+    VertexStreams vertices;
+    FaceBuffer faces;
+    float error;    // distance between this surface and the full mesh's, in object space
+};
+
+struct Mesh
+{
+    glm::vec3 position;
+    glm::vec3 rotation;
+    VertexStreams vertices;
+    FaceBuffer faces;
+    std::vector<MeshLod> lods;      // coarser and coarser, when built (see buildLods)
+
+    std::string textureFile;                // diffuse texture of the mesh's material, if any,
+                                            // as written in the .babylon file: relative to it
+    std::shared_ptr<const Texture> texture; // loaded from textureFile (see loadMeshTextures)
+
+    Bounds bounds;                  // computed at load time
+    bool backFaceCulling = true;    // from the mesh's material
+};
+
+// Vertex cache optimization: Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+// Faces are reordered greedily: the next face is the one whose vertices score
+// best, a vertex scoring high when it was recently used (it would still be in
+// a cache of transformed vertices) and when few faces still use it (so that
+// it leaves the cache for good).
+// See: https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+constexpr int vertexCacheSize = 32;
+
+inline float vertexCacheScore(int cachePosition, uint32_t remainingFaces)
+{
+    if(remainingFaces == 0)
+    {
+        return -1.0f;   // no face left to draw with this vertex
+    }
+
+    float score = 0.0f;
+    if(cachePosition >= 0)
+    {
+        // the 3 vertices of the last face get a fixed score, so that the
+        // next face does not prefer to reuse them over the older ones
+        score = cachePosition < 3
+              ? 0.75f
+              : std::pow(1.0f - (cachePosition - 3) / float(vertexCacheSize - 3), 1.5f);
+    }
+    // vertices with few faces left are favored, to get rid of them
+    return score + 2.0f * std::pow(static_cast<float>(remainingFaces), -0.5f);
+}
+
+// Reorders the faces (3 indices each) of a mesh of vertexCount vertices
+inline void optimizeFaceOrder(std::vector<uint32_t> &indices, size_t vertexCount)
+{
+    const size_t faceCount = indices.size() / 3;
+
+    // faces of each vertex (offsets & list), and how many are not emitted yet
+    std::vector<uint32_t> faceOffsets(vertexCount + 1, 0);
+    for(size_t i = 0; i < faceCount * 3; i++)
+    {
+        faceOffsets[indices[i] + 1]++;
+    }
+    for(size_t v = 0; v < vertexCount; v++)
+    {
+        faceOffsets[v + 1] += faceOffsets[v];
+    }
+    std::vector<uint32_t> remaining(vertexCount);
+    for(size_t v = 0; v < vertexCount; v++)
+    {
+        remaining[v] = faceOffsets[v + 1] - faceOffsets[v];
+    }
+    std::vector<uint32_t> vertexFaces(faceCount * 3);
+    {
+        auto fill = faceOffsets;
+        for(size_t i = 0; i < faceCount * 3; i++)
+        {
+            vertexFaces[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for(size_t v = 0; v < vertexCount; v++)
+    {
+        vertexScore[v] = vertexCacheScore(-1, remaining[v]);
+    }
+    std::vector<float> faceScore(faceCount);
+    std::vector<bool> emitted(faceCount, false);
+    for(size_t f = 0; f < faceCount; f++)
+    {
+        faceScore[f] = vertexScore[indices[f*3]] + vertexScore[indices[f*3 + 1]] + vertexScore[indices[f*3 + 2]];
+    }
+
+    // the cache, most recent vertex first, with room for the 3 vertices added
+    std::vector<uint32_t> cache;
+    cache.reserve(vertexCacheSize + 3);
+
+    std::vector<uint32_t> ordered;
+    ordered.reserve(faceCount * 3);
+    size_t nextFace = 0;   // faces before it are all emitted
+    while(ordered.size() < faceCount * 3)
+    {
+        // best face among the faces of the cached vertices,
+        // else the next face not emitted yet
+        int64_t best = -1;
+        float bestScore = -1.0f;
+        for(const auto v : cache)
+        {
+            for(auto k = faceOffsets[v]; k < faceOffsets[v + 1]; k++)
+            {
+                const auto f = vertexFaces[k];
+                if(!emitted[f] && faceScore[f] > bestScore)
+                {
+                    best = f;
+                    bestScore = faceScore[f];
+                }
+            }
+        }
+        if(best < 0)
+        {
+            while(emitted[nextFace])
+            {
+                nextFace++;
+            }
+            best = static_cast<int64_t>(nextFace);
+        }
+
+        emitted[best] = true;
+        std::array<uint32_t, 3> face;
+        for(int i = 0; i < 3; i++)
+        {
+            face[i] = indices[best*3 + i];
+            ordered.push_back(face[i]);
+            remaining[face[i]]--;
+        }
+
+        // the face's vertices move to the front of the cache, in their order
+        for(int i = 2; i >= 0; i--)
+        {
+            const auto found = std::find(cache.begin(), cache.end(), face[i]);
+            if(found != cache.end())
+            {
+                cache.erase(found);
+            }
+            cache.insert(cache.begin(), face[i]);
+        }
+
+        // the scores change for the cached vertices, and for those leaving the cache
+        for(size_t i = 0; i < cache.size(); i++)
+        {
+            const auto v = cache[i];
+            cachePosition[v] = i < vertexCacheSize ? static_cast<int>(i) : -1;
+            vertexScore[v] = vertexCacheScore(cachePosition[v], remaining[v]);
+        }
+        for(const auto v : cache)
+        {
+            for(auto k = faceOffsets[v]; k < faceOffsets[v + 1]; k++)
+            {
+                const auto f = vertexFaces[k];
+                if(!emitted[f])
+                {
+                    faceScore[f] = vertexScore[indices[f*3]] + vertexScore[indices[f*3 + 1]] + vertexScore[indices[f*3 + 2]];
+                }
+            }
+        }
+        if(cache.size() > vertexCacheSize)
+        {
+            cache.resize(vertexCacheSize);
+        }
+    }
+
+    indices = std::move(ordered);
+}
+
+// Vertices of a mesh, in another order: vertex v moves to remap[v],
+// and is dropped when remap[v] is not below count
+inline VertexStreams remapVertices(const VertexStreams &in, const std::vector<uint32_t> &remap, size_t count)
+{
+    VertexStreams out;
+    out.resize(count, in.hasUV());
+    for(const auto stream : { &VertexStreams::x, &VertexStreams::y, &VertexStreams::z,
+                              &VertexStreams::nx, &VertexStreams::ny, &VertexStreams::nz,
+                              &VertexStreams::u, &VertexStreams::v })
+    {
+        const auto &from = in.*stream;
+        auto &to = out.*stream;
+        for(size_t v = 0; v < std::min(in.size(), from.size()); v++)
+        {
+            if(remap[v] < count)
+            {
+                to[remap[v]] = from[v];
+            }
+        }
+    }
+    return out;
+}
+
+// Reorders faces & vertices for the order the triangle stage reads them:
+// the faces for the reuse of recently transformed vertices (optimizeFaceOrder),
+// then the vertices in the order the faces first use them, so that the
+// transformed vertices are read almost sequentially.
+// Note: only the order changes, the geometry stays the same; the vertices
+// used by no face are moved at the end
+inline void optimizeVertexOrder(VertexStreams &vertices, FaceBuffer &faces)
+{
+    const auto vertexCount = vertices.size();
+
+    auto indices = faceIndices(faces);
+    optimizeFaceOrder(indices, vertexCount);
+
+    // new index of each vertex, in first use order
+    constexpr auto unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(vertexCount, unused);
+    uint32_t next = 0;
+    for(auto &index : indices)
+    {
+        if(remap[index] == unused)
+        {
+            remap[index] = next++;
+        }
+        index = remap[index];
+    }
+    for(auto &index : remap)
+    {
+        if(index == unused)
+        {
+            index = next++;
+        }
+    }
+
+    vertices = remapVertices(vertices, remap, vertexCount);
+    faces = makeFaces(indices, vertexCount);
+}
+
+// Optimizes a mesh, and its levels of detail, with optimizeVertexOrder
+inline void optimizeMesh(Mesh &mesh)
+{
+    optimizeVertexOrder(mesh.vertices, mesh.faces);
+    for(auto &lod : mesh.lods)
+    {
+        optimizeVertexOrder(lod.vertices, lod.faces);
+    }
+}
+
+// Quadric error metric (Garland & Heckbert): the sum of the squared distances
+// from a point p to a set of planes, p^T A p + 2 b^T p + c
+// See: https://www.cs.cmu.edu/~garland/Papers/quadrics.pdf
+struct Quadric
+{
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;    // A, symmetric
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+    double weight = 0;  // of all the planes
+
+    // Plane of unit normal n through p, weighted (e.g. by the area of a face)
+    static Quadric plane(const glm::vec3 &n, const glm::vec3 &p, double w)
+    {
+        const double x = n.x, y = n.y, z = n.z;
+        const double d = -(x*p.x + y*p.y + z*p.z);
+        Quadric q;
+        q.a00 = w*x*x; q.a01 = w*x*y; q.a02 = w*x*z;
+        q.a11 = w*y*y; q.a12 = w*y*z; q.a22 = w*z*z;
+        q.b0 = w*x*d; q.b1 = w*y*d; q.b2 = w*z*d;
+        q.c = w*d*d;
+        q.weight = w;
+        return q;
+    }
+
+    Quadric operator+(const Quadric &q) const
+    {
+        Quadric r = *this;
+        r.a00 += q.a00; r.a01 += q.a01; r.a02 += q.a02;
+        r.a11 += q.a11; r.a12 += q.a12; r.a22 += q.a22;
+        r.b0 += q.b0; r.b1 += q.b1; r.b2 += q.b2;
+        r.c += q.c;
+        r.weight += q.weight;
+        return r;
+    }
+
+    // Mean distance of p to the planes (root of the weighted mean squared distance)
+    double distance(const glm::vec3 &p) const
+    {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e = x*(a00*x + a01*y + a02*z) + y*(a01*x + a11*y + a12*z) + z*(a02*x + a12*y + a22*z)
+                       + 2.0*(b0*x + b1*y + b2*z) + c;
+        return weight > 0 ? std::sqrt(std::max(e, 0.0) / weight) : 0.0;
+    }
+};
+
+// Builds the levels of detail of a mesh, each with about half the faces of
+// the previous one, by collapsing the edges which move the surface the least
+// (quadric error metric), until the mesh cannot be simplified further.
+// A collapse moves a vertex onto one of its neighbours, so the levels only
+// use vertices of the full mesh; they get their own compact vertex streams.
+// Note: vertices at the same position (e.g. on both sides of a normal seam)
+// are simplified together, each face corner then keeping the vertex of the
+// same position with the closest normal to its original vertex
+inline void buildLods(Mesh &mesh)
+{
+    constexpr size_t maxLods = 8;
+    constexpr size_t minFaces = 16;
+    constexpr double boundaryWeight = 10.0;     // keeps the open borders in place
+    constexpr float minNormalDot = 0.2f;        // rejects collapses folding a face over
+
+    mesh.lods.clear();
+    const auto &vertices = mesh.vertices;
+    const auto indices = faceIndices(mesh.faces);
+    const size_t faceCount = indices.size() / 3;
+
+    // vertices at the same position form one point of the simplified surface
+    std::vector<uint32_t> pointOf(vertices.size());
+    std::vector<glm::vec3> points;
+    std::vector<std::vector<uint32_t>> pointVertices;
+    {
+        std::map<std::array<float, 3>, uint32_t> byPosition;
+        for(size_t v = 0; v < vertices.size(); v++)
+        {
+            const auto found = byPosition.emplace(std::array<float, 3>{ vertices.x[v], vertices.y[v], vertices.z[v] },
+                                                  static_cast<uint32_t>(points.size()));
+            if(found.second)
+            {
+                points.push_back(vertices.position(v));
+                pointVertices.emplace_back();
+            }
+            pointOf[v] = found.first->second;
+            pointVertices[pointOf[v]].push_back(static_cast<uint32_t>(v));
+        }
+    }
+    const size_t pointCount = points.size();
+
+    // the faces as points, updated by each collapse
+    std::vector<uint32_t> corners(indices.size());
+    std::vector<bool> removed(faceCount, false);
+    std::vector<std::vector<uint32_t>> pointFaces(pointCount);
+    size_t liveFaces = 0;
+    for(size_t f = 0; f < faceCount; f++)
+    {
+        for(int k = 0; k < 3; k++)
+        {
+            corners[f*3 + k] = pointOf[indices[f*3 + k]];
+        }
+        const auto a = corners[f*3], b = corners[f*3 + 1], c = corners[f*3 + 2];
+        removed[f] = (a == b || b == c || c == a);
+        if(!removed[f])
+        {
+            liveFaces++;
+            for(int k = 0; k < 3; k++)
+            {
+                pointFaces[corners[f*3 + k]].push_back(static_cast<uint32_t>(f));
+            }
+        }
+    }
+
+    // each point's quadric: the planes of its faces, weighted by their area,
+    // and, along the borders, planes perpendicular to the faces
+    std::vector<Quadric> quadrics(pointCount);
+    std::unordered_map<uint64_t, uint32_t> edgeFaces;   // by (smaller point << 32 | larger point)
+    const auto edgeKey = [](uint32_t a, uint32_t b) { return uint64_t(std::min(a, b)) << 32 | std::max(a, b); };
+    for(size_t f = 0; f < faceCount; f++)
+    {
+        if(removed[f])
+        {
+            continue;
+        }
+        for(int k = 0; k < 3; k++)
+        {
+            const auto a = corners[f*3 + k], b = corners[f*3 + (k + 1) % 3];
+            edgeFaces[edgeKey(a, b)]++;
+        }
+    }
+    for(size_t f = 0; f < faceCount; f++)
+    {
+        if(removed[f])
+        {
+            continue;
+        }
+        const glm::vec3 p[3] = { points[corners[f*3]], points[corners[f*3 + 1]], points[corners[f*3 + 2]] };
+        const auto normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        const float area2 = glm::length(normal);
+        if(area2 <= 0.0f)
+        {
+            continue;
+        }
+        const auto n = normal / area2;
+        const auto q = Quadric::plane(n, p[0], 0.5 * area2);
+        for(int k = 0; k < 3; k++)
+        {
+            quadrics[corners[f*3 + k]] = quadrics[corners[f*3 + k]] + q;
+
+            const auto a = corners[f*3 + k], b = corners[f*3 + (k + 1) % 3];
+            if(edgeFaces[edgeKey(a, b)] == 1)
+            {
+                const auto edge = p[(k + 1) % 3] - p[k];
+                const float length = glm::length(edge);
+                if(length > 0.0f)
+                {
+                    const auto border = Quadric::plane(glm::normalize(glm::cross(edge, n)), p[k],
+                                                       boundaryWeight * length * length);
+                    quadrics[a] = quadrics[a] + border;
+                    quadrics[b] = quadrics[b] + border;
+                }
+            }
+        }
+    }
+    edgeFaces.clear();
+
+    // candidate collapses, cheapest first; a candidate is stale once one of
+    // its points changed (see version)
+    struct Collapse
+    {
+        double cost;
+        uint32_t from, to;
+        uint32_t fromVersion, toVersion;
+        bool operator<(const Collapse &c) const { return cost > c.cost; }
+    };
+    std::priority_queue<Collapse> candidates;
+    std::vector<uint32_t> version(pointCount, 0);
+    std::vector<bool> collapsed(pointCount, false);
+
+    // the best direction to collapse the edge (a, b)
+    const auto pushEdge = [&](uint32_t a, uint32_t b)
+    {
+        const auto q = quadrics[a] + quadrics[b];
+        const double toB = q.distance(points[b]);
+        const double toA = q.distance(points[a]);
+        candidates.push(toB <= toA ? Collapse{ toB, a, b, version[a], version[b] }
+                                   : Collapse{ toA, b, a, version[b], version[a] });
+    };
+    const auto pushEdges = [&](uint32_t p)
+    {
+        std::vector<uint32_t> neighbours;
+        for(const auto f : pointFaces[p])
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                const auto n = corners[f*3 + k];
+                if(!removed[f] && n != p && std::find(neighbours.begin(), neighbours.end(), n) == neighbours.end())
+                {
+                    neighbours.push_back(n);
+                    pushEdge(p, n);
+                }
+            }
+        }
+    };
+    for(uint32_t p = 0; p < pointCount; p++)
+    {
+        for(const auto f : pointFaces[p])
+        {
+            for(int k = 0; k < 3; k++)
+            {
+                // each edge once, from its smaller point
+                if(corners[f*3 + k] == p && corners[f*3 + (k + 1) % 3] > p)
+                {
+                    pushEdge(p, corners[f*3 + (k + 1) % 3]);
+                }
+                if(corners[f*3 + k] == p && corners[f*3 + (k + 2) % 3] > p)
+                {
+                    pushEdge(p, corners[f*3 + (k + 2) % 3]);
+                }
+            }
+        }
+    }
+
+    // True when moving point from onto point to would fold one of from's faces over
+    const auto foldsOver = [&](uint32_t from, uint32_t to)
+    {
+        for(const auto f : pointFaces[from])
+        {
+            if(removed[f] ||
+               corners[f*3] == to || corners[f*3 + 1] == to || corners[f*3 + 2] == to)
+            {
+                continue;
+            }
+            glm::vec3 p[3], moved[3];
+            for(int k = 0; k < 3; k++)
+            {
+                p[k] = points[corners[f*3 + k]];
+                moved[k] = corners[f*3 + k] == from ? points[to] : p[k];
+            }
+            const auto before = glm::cross(p[1] - p[0], p[2] - p[0]);
+            const auto after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+            const float lengths = glm::length(before) * glm::length(after);
+            if(lengths <= 0.0f || glm::dot(before, after) < minNormalDot * lengths)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    double error = 0.0;
+    while(mesh.lods.size() < maxLods && liveFaces > minFaces)
+    {
+        const size_t target = liveFaces / 2;
+        const size_t before = liveFaces;
+        while(liveFaces > target && !candidates.empty())
+        {
+            const auto candidate = candidates.top();
+            candidates.pop();
+            const auto from = candidate.from, to = candidate.to;
+            if(collapsed[from] || collapsed[to] ||
+               candidate.fromVersion != version[from] || candidate.toVersion != version[to] ||
+               foldsOver(from, to))
+            {
+                continue;
+            }
+
+            collapsed[from] = true;
+            version[to]++;
+            quadrics[to] = quadrics[to] + quadrics[from];
+            error = std::max(error, candidate.cost);
+
+            for(const auto f : pointFaces[from])
+            {
+                if(removed[f])
+                {
+                    continue;
+                }
+                for(int k = 0; k < 3; k++)
+                {
+                    if(corners[f*3 + k] == from)
+                    {
+                        corners[f*3 + k] = to;
+                    }
+                }
+                const auto a = corners[f*3], b = corners[f*3 + 1], c = corners[f*3 + 2];
+                if(a == b || b == c || c == a)
+                {
+                    removed[f] = true;
+                    liveFaces--;
+                }
+                else
+                {
+                    pointFaces[to].push_back(f);
+                }
+            }
+            pointFaces[from].clear();
+            pointFaces[to].erase(std::remove_if(pointFaces[to].begin(), pointFaces[to].end(),
+                                                [&](uint32_t f) { return removed[f]; }),
+                                 pointFaces[to].end());
+            pushEdges(to);
+        }
+        if(liveFaces == before)
+        {
+            break;
+        }
+
+        // the level: each corner keeps a vertex of its point, the one with the
+        // closest normal, and only the vertices used are kept
+        constexpr auto unused = std::numeric_limits<uint32_t>::max();
+        std::vector<uint32_t> remap(vertices.size(), unused);
+        std::vector<uint32_t> lodIndices;
+        lodIndices.reserve(liveFaces * 3);
+        uint32_t used = 0;
+        for(size_t f = 0; f < faceCount; f++)
+        {
+            if(removed[f])
+            {
+                continue;
+            }
+            for(int k = 0; k < 3; k++)
+            {
+                auto v = indices[f*3 + k];
+                const auto point = corners[f*3 + k];
+                if(pointOf[v] != point)
+                {
+                    const auto normal = vertices.normal(v);
+                    float bestDot = -std::numeric_limits<float>::max();
+                    for(const auto candidate : pointVertices[point])
+                    {
+                        const float d = glm::dot(normal, vertices.normal(candidate));
+                        if(d > bestDot)
+                        {
+                            bestDot = d;
+                            v = candidate;
+                        }
+                    }
+                }
+                if(remap[v] == unused)
+                {
+                    remap[v] = used++;
+                }
+                lodIndices.push_back(remap[v]);
+            }
+        }
+
+        MeshLod lod;
+        lod.vertices = remapVertices(vertices, remap, used);
+        lod.faces = makeFaces(lodIndices, used);
+        lod.error = static_cast<float>(error);
+        mesh.lods.push_back(std::move(lod));
+    }
+}
+
+// What processScanline needs to know about the triangle being drawn
+// Note: the tutorial keeps the light of the 4 ends of the 2 edges (nDotLa to
+// nDotLd) and interpolates between them at each pixel. The light & Z being
+// linear on screen, they are planes here, set up once per triangle: a span
+// only evaluates them at its first pixel, then adds their X gradient.
+struct ScanLineData
+{
+    int currentY;
+
+    ScreenPlane nDotL;          // Gouraud shading: the light of the 3 vertices
+    ScreenPlane z;
+
+    TextureMapping mapping;     // of textured triangles (see shadeTexel)
+};
+
+namespace std {
+    // std::lerp is only available from c++17
+    constexpr float clamp(float v, float lo, float hi)
+    {
+        return (v < lo) ? lo : (hi < v) ? hi : v;
+    }
+
+    // std::lerp is only available from c++20
+    constexpr float lerp(float a, float b, float t) {
+        return a + clamp(t, 0, 1)*(b-a);
+    }
+}
+
+// Reads a binary PPM image (P6, as written by savePPM) into RGBA_8888 pixels,
+// line by line from the top
+inline bool readPPM(const std::string &filename, int &width, int &height, std::vector<uint32_t> &pixels)
+{
+    std::ifstream file(filename, std::ios::binary);
+
+    // header fields are separated by whitespaces & # comments
+    const auto field = [&file](int &value)
+    {
+        while((file >> std::ws).peek() == '#')
+        {
+            file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        }
+        return static_cast<bool>(file >> value);
+    };
+
+    std::string magic;
+    int maxValue = 0;
+    if(!(file >> magic) || magic != "P6" ||
+       !field(width) || !field(height) || !field(maxValue) ||
+       width <= 0 || height <= 0 || width > 32768 || height > 32768 ||
+       maxValue <= 0 || maxValue > 255)
+    {
+        return false;
+    }
+    file.get(); // the single whitespace before the pixels
+
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    if(!file.read(reinterpret_cast<char*>(rgb.data()), static_cast<std::streamsize>(rgb.size())))
+    {
+        return false;
+    }
+
+    pixels.resize(static_cast<size_t>(width) * height);
+    for(size_t i = 0; i < pixels.size(); i++)
+    {
+        pixels[i] = toRGBA8888({ static_cast<uint8_t>(rgb[3*i]     * 255 / maxValue),
+                                 static_cast<uint8_t>(rgb[3*i + 1] * 255 / maxValue),
+                                 static_cast<uint8_t>(rgb[3*i + 2] * 255 / maxValue),
+                                 255 });
+    }
+    return true;
+}
+
+// Reads a true color TGA image (24 or 32 bits, raw or RLE compressed)
+// into RGBA_8888 pixels, line by line from the top
+inline bool readTGA(const std::string &filename, int &width, int &height, std::vector<uint32_t> &pixels)
+{
+    std::ifstream file(filename, std::ios::binary);
+
+    uint8_t header[18];
+    if(!file.read(reinterpret_cast<char*>(header), sizeof(header)))
+    {
+        return false;
+    }
+    const int idLength = header[0];
+    const int colorMapType = header[1];
+    const int imageType = header[2];    // 2: raw, 10: RLE
+    width  = header[12] | (header[13] << 8);
+    height = header[14] | (header[15] << 8);
+    const int bytesPerPixel = header[16] / 8;
+    const bool topDown = (header[17] & 0x20) != 0;
+    if(colorMapType != 0 || (imageType != 2 && imageType != 10) ||
+       (header[16] != 24 && header[16] != 32) || width == 0 || height == 0)
+    {
+        return false;
+    }
+    file.ignore(idLength);
+
+    // BGR(A) pixels, from the bottom line unless topDown
+    std::vector<uint8_t> data(static_cast<size_t>(width) * height * bytesPerPixel);
+    if(imageType == 2)
+    {
+        if(!file.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size())))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        // packets of 1 to 128 pixels: one pixel repeated, or raw pixels
+        for(size_t i = 0; i < data.size(); )
+        {
+            const int packet = file.get();
+            const size_t count = static_cast<size_t>((packet & 0x7f) + 1) * bytesPerPixel;
+            if(packet < 0 || count > data.size() - i)
+            {
+                return false;
+            }
+            const auto repeated = (packet & 0x80) != 0;
+            if(!file.read(reinterpret_cast<char*>(&data[i]), static_cast<std::streamsize>(repeated ? bytesPerPixel : count)))
+            {
+                return false;
+            }
+            for(size_t j = bytesPerPixel; repeated && j < count; j++)
+            {
+                data[i + j] = data[i + j - bytesPerPixel];
+            }
+            i += count;
+        }
+    }
+
+    pixels.resize(static_cast<size_t>(width) * height);
+    for(int y = 0; y < height; y++)
+    {
+        const uint8_t *line = &data[static_cast<size_t>(topDown ? y : height - 1 - y) * width * bytesPerPixel];
+        for(int x = 0; x < width; x++)
+        {
+            const uint8_t *p = line + x * bytesPerPixel;
+            pixels[x + static_cast<size_t>(y) * width] =
+                toRGBA8888({ p[2], p[1], p[0], bytesPerPixel == 4 ? p[3] : uint8_t(255) });
+        }
+    }
+    return true;
+}
+
+// Loads a PPM or a TGA texture, chosen by the extension of the file
+// Note: for other formats (e.g. the PNG & JPEG files Babylon exports), a
+// file with the same name and a .tga or .ppm extension is looked for
+// Returns nullptr when no texture could be read
+inline std::shared_ptr<Texture> loadTexture(const std::string &filename)
+{
+    for(const auto *extension : { "", ".tga", ".ppm" })
+    {
+        auto path = std::filesystem::path(filename);
+        if(*extension)
+        {
+            path.replace_extension(extension);
+        }
+
+        int width = 0, height = 0;
+        std::vector<uint32_t> pixels;
+        const auto type = path.extension().string();
+        if((type == ".tga" && readTGA(path.string(), width, height, pixels)) ||
+           (type == ".ppm" && readPPM(path.string(), width, height, pixels)))
+        {
+            return std::make_shared<Texture>(width, height, pixels.data());
+        }
+    }
+    return nullptr;
+}
+
+// Loads the textures of the meshes, once per file, from the directory
+// of their .babylon file
+// Note: a texture which cannot be loaded is reported,
+// and the meshes using it are drawn without texture
+inline void loadMeshTextures(std::vector<Mesh> &meshes, const std::filesystem::path &directory)
+{
+    std::map<std::string, std::shared_ptr<const Texture>> textures;
+    for(auto &mesh : meshes)
+    {
+        if(mesh.textureFile.empty())
+        {
+            continue;
+        }
+        auto loaded = textures.find(mesh.textureFile);
+        if(loaded == textures.end())
+        {
+            const auto path = (directory / mesh.textureFile).string();
+            auto texture = loadTexture(path);
+            if(!texture)
+            {
+                std::cerr << "Cannot load the texture " << path << std::endl;
+            }
+            loaded = textures.emplace(mesh.textureFile, std::move(texture)).first;
+        }
+        mesh.texture = loaded->second;
+    }
+}
+
+// What is done to the meshes once loaded
+struct MeshLoadOptions
+{
+    bool lods = false;      // builds their levels of detail (see buildLods)
+    bool optimize = false;  // reorders their faces & vertices (see optimizeMesh)
+
+    uint32_t flags() const { return (lods ? 1 : 0) | (optimize ? 2 : 0); }
+};
+
+// Consumer of the events of a .babylon file's parser (see tao::json::events):
+// only the values the engine uses are kept, straight into each mesh's arrays,
+// everything else is skipped as it is parsed. No JSON value is ever built.
+// Paths recognized:
+//   materials[*].id, materials[*].backFaceCulling, materials[*].diffuseTexture.name
+//   meshes[*].vertices, indices, uvCount, position, rotation, materialId
+// Note: depth counts the objects & arrays open around the current value,
+// so the fields of a mesh are at depth 3 (root, "meshes" array, mesh object),
+// and those of a material's texture at depth 4
+class BabylonConsumer
+{
+public:
+    // A mesh as it is parsed, converted once its object ends
+    struct ParsedMesh
+    {
+        std::vector<float> vertices;    // interleaved, as in the file
+        std::vector<uint32_t> indices;
+        uint32_t uvCount = 0;
+        glm::vec3 position{ 0.0f };
+        glm::vec3 rotation{ 0.0f };
+        std::string materialId;
+    };
+
+    std::vector<Mesh> meshes;
+    std::map<std::string, bool> backFaceCulling;   // by material id
+    std::map<std::string, std::string> textures;    // by material id: file name of its diffuse texture
+    std::vector<std::string> materialIds;           // by mesh
+
+    void null() {}
+    void boolean(const bool v)
+    {
+        if(m_depth == 3 && m_section == Section::Materials && m_field == Field::BackFaceCulling)
+        {
+            m_materialCulling = v;
+        }
+    }
+
+    void number(const std::int64_t v) { value(static_cast<double>(v)); }
+    void number(const std::uint64_t v) { value(static_cast<double>(v)); }
+    void number(const double v) { value(v); }
+
+    void string(const std::string_view v)
+    {
+        if(m_depth == 4 && m_section == Section::Materials && m_field == Field::DiffuseTexture && m_textureName)
+        {
+            m_materialTexture = v;
+        }
+        if(m_depth != 3)
+        {
+            return;
+        }
+        if(m_section == Section::Meshes && m_field == Field::MaterialId)
+        {
+            m_mesh.materialId = v;
+        }
+        else if(m_section == Section::Materials && m_field == Field::Id)
+        {
+            m_materialId = v;
+        }
+    }
+
+    void binary(const tao::binary_view) {}
+
+    void begin_array(const std::size_t = 0)
+    {
+        m_depth++;
+        m_component = 0;
+    }
+    void element() {}
+    void end_array(const std::size_t = 0) { m_depth--; }
+
+    void begin_object(const std::size_t = 0)
+    {
+        m_depth++;
+        if(m_depth == 3)
+        {
+            m_mesh = {};
+            m_materialId.clear();
+            m_materialCulling = true;
+            m_materialTexture.clear();
+        }
+    }
+    void key(const std::string_view k)
+    {
+        if(m_depth == 1)
+        {
+            m_section = k == "meshes" ? Section::Meshes : k == "materials" ? Section::Materials : Section::Other;
+        }
+        else if(m_depth == 3)
+        {
+            m_field = k == "vertices"        ? Field::Vertices
+                    : k == "indices"         ? Field::Indices
+                    : k == "uvCount"         ? Field::UVCount
+                    : k == "position"        ? Field::Position
+                    : k == "rotation"        ? Field::Rotation
+                    : k == "materialId"      ? Field::MaterialId
+                    : k == "id"              ? Field::Id
+                    : k == "backFaceCulling" ? Field::BackFaceCulling
+                    : k == "diffuseTexture"  ? Field::DiffuseTexture
+                    : Field::Other;
+        }
+        else if(m_depth == 4)
+        {
+            m_textureName = k == "name";
+        }
+    }
+    void member() {}
+    void end_object(const std::size_t = 0)
+    {
+        if(m_depth == 3 && m_section == Section::Meshes)
+        {
+            meshes.push_back(toMesh(m_mesh));
+            materialIds.push_back(std::move(m_mesh.materialId));
+            m_mesh = {};
+        }
+        else if(m_depth == 3 && m_section == Section::Materials && !m_materialId.empty())
+        {
+            backFaceCulling[m_materialId] = m_materialCulling;
+            if(!m_materialTexture.empty())
+            {
+                textures[m_materialId] = m_materialTexture;
+            }
+        }
+        m_depth--;
+    }
+
+private:
+    enum class Section { Other, Meshes, Materials };
+    enum class Field { Other, Vertices, Indices, UVCount, Position, Rotation, MaterialId, Id, BackFaceCulling, DiffuseTexture };
+
+    void value(const double v)
+    {
+        if(m_section != Section::Meshes)
+        {
+            return;
+        }
+        if(m_depth == 4)
+        {
+            switch(m_field)
+            {
+                case Field::Vertices:
+                    m_mesh.vertices.push_back(static_cast<float>(v));
+                    break;
+                case Field::Indices:
+                    m_mesh.indices.push_back(static_cast<uint32_t>(v));
+                    break;
+                case Field::Position:
+                case Field::Rotation:
+                    if(m_component < 3)
+                    {
+                        (m_field == Field::Position ? m_mesh.position : m_mesh.rotation)[m_component++] = static_cast<float>(v);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        else if(m_depth == 3 && m_field == Field::UVCount)
+        {
+            m_mesh.uvCount = static_cast<uint32_t>(v);
+        }
+    }
+
+    static Mesh toMesh(const ParsedMesh &parsed)
+    {
+        // Depending of the number of texture's coordinates per vertex
+        // we're jumping in the vertices array by 6, 8 & 10 windows frame
+        const uint32_t verticesStep = 6 + 2 * std::min(parsed.uvCount, 2u);
+
+        // the number of interesting vertices information for us
+        const auto verticesCount = parsed.vertices.size() / verticesStep;
+
+        Mesh mesh;
+
+        // Filling the vertices streams of our mesh first
+        // Note: only the first set of texture's coordinates is kept
+        auto &streams = mesh.vertices;
+        streams.resize(verticesCount, parsed.uvCount > 0);
+        for(size_t i = 0; i < verticesCount; i++)
+        {
+            const float *vertex = &parsed.vertices[i * verticesStep];
+            streams.x[i] = vertex[0];
+            streams.y[i] = vertex[1];
+            streams.z[i] = vertex[2];
+            // Loading the vertex normal exported by Blender
+            streams.nx[i] = vertex[3];
+            streams.ny[i] = vertex[4];
+            streams.nz[i] = vertex[5];
+
+            if(streams.hasUV())
+            {
+                streams.u[i] = vertex[6];
+                streams.v[i] = vertex[7];
+            }
+        }
+
+        // Then filling the Faces array
+        // Note: in Babylon, indices = faces
+        // Note: like a syntax error, a face out of the vertices fails the load,
+        // before anything (the mesh cache) keeps it
+        for(const auto index : parsed.indices)
+        {
+            if(index >= verticesCount)
+            {
+                throw std::runtime_error("face index " + std::to_string(index) +
+                                         " out of the " + std::to_string(verticesCount) + " vertices of a mesh");
+            }
+        }
+        mesh.faces = makeFaces(parsed.indices, verticesCount);
+
+        // Getting the position & rotation you have set in Blender
+        mesh.position = parsed.position;
+        mesh.rotation = parsed.rotation;
+
+        mesh.bounds = computeBounds(mesh.vertices);
+        return mesh;
+    }
+
+    int m_depth = 0;
+    Section m_section = Section::Other;
+    Field m_field = Field::Other;
+    int m_component = 0;            // in position & rotation
+
+    ParsedMesh m_mesh;
+    std::string m_materialId;
+    bool m_materialCulling = true;
+    std::string m_materialTexture;
+    bool m_textureName = false;     // in a texture, at its "name" key
+};
+
+// Loads the meshes of a .babylon file, streaming its JSON: the file is
+// parsed once, and the vertices & indices of a mesh are only held twice
+// (as parsed, then as the mesh's arrays) until the end of this mesh
+inline std::vector<Mesh> loadJsonMesh(std::string filename, const MeshLoadOptions &options = {})
+{
+    BabylonConsumer consumer;
+    tao::json::events::from_file(consumer, filename);
+
+    // Note: like in Babylon, a mesh without material is drawn with a
+    // default one, which culls back faces
+    auto meshes = std::move(consumer.meshes);
+    for(size_t i = 0; i < meshes.size(); i++)
+    {
+        const auto material = consumer.backFaceCulling.find(consumer.materialIds[i]);
+        if(material != consumer.backFaceCulling.end())
+        {
+            meshes[i].backFaceCulling = material->second;
+        }
+        // Note: texture files are relative to the .babylon file,
+        // and only used by meshes with texture coordinates
+        const auto texture = consumer.textures.find(consumer.materialIds[i]);
+        if(texture != consumer.textures.end() && meshes[i].vertices.hasUV())
+        {
+            meshes[i].textureFile = texture->second;
+        }
+        if(options.lods)
+        {
+            buildLods(meshes[i]);
+        }
+        if(options.optimize)
+        {
+            optimizeMesh(meshes[i]);
+        }
+    }
+
+    loadMeshTextures(meshes, std::filesystem::path(filename).parent_path());
+    return meshes;
+}
+
+// Mesh cache: the meshes of a .babylon file saved in a binary file, next to it,
+// the first time they are loaded (see loadCachedMesh). On the next runs, the
+// file is memory mapped and the meshes use their vertex streams and faces
+// right where they are mapped: nothing is parsed nor copied, and the pages
+// are only read from the disk once used.
+// Layout, in the native byte order:
+//   MeshCacheHeader
+//   MeshCacheEntry, one per mesh, each followed by one per level of detail
+//   the texture file names of the meshes, one after the other (no terminating zero)
+//   for each entry, 32 bytes aligned: its vertex streams, one after the other
+//   (see VertexStreams::setStreams), then its faces (16 or 32 bits indices)
+// Note: the cache is rebuilt when the size or the modification time of the
+// .babylon file changes, when the version of the format changes, or when
+// the meshes are loaded with other MeshLoadOptions
+struct MeshCacheHeader
+{
+    char magic[8];          // "SEMESH" & 2 zeros
+    uint32_t version;
+    uint32_t entryCount;
+    uint64_t sourceSize;    // of the .babylon file the meshes come from
+    int64_t sourceTime;     // its modification time
+    uint32_t options;       // MeshLoadOptions::flags()
+    uint32_t reserved;
+};
+
+struct MeshCacheEntry
+{
+    glm::vec3 position;     // position to backFaceCulling: meshes only
+    glm::vec3 rotation;
+    Bounds bounds;
+    uint32_t backFaceCulling;
+    uint32_t lodCount;      // entries following a mesh's, its levels of detail
+    float lodError;         // levels of detail only (see MeshLod::error)
+    uint32_t hasUV;
+    uint32_t indexSize;     // of the faces, 2 or 4 bytes (see FaceBuffer)
+    uint32_t textureLength; // of Mesh::textureFile, meshes only (0: no texture)
+    uint64_t vertexCount;
+    uint64_t faceCount;
+    uint64_t streamsOffset; // from the start of the file
+    uint64_t facesOffset;
+    uint64_t textureOffset;
+};
+
+constexpr char meshCacheMagic[8] = { 'S', 'E', 'M', 'E', 'S', 'H', 0, 0 };
+constexpr uint32_t meshCacheVersion = 6;
+constexpr uint64_t meshCacheAlignment = 32;
+
+// Identifies the version of a .babylon file a cache was built from
+inline bool sourceStamp(const std::string &filename, uint64_t &size, int64_t &time)
+{
+    std::error_code error;
+    size = std::filesystem::file_size(filename, error);
+    if(error)
+    {
+        return false;
+    }
+    time = std::filesystem::last_write_time(filename, error).time_since_epoch().count();
+    return !error;
+}
+
+// Maps a whole file in memory, privately: pages written to are copied,
+// the file itself is never modified. The file is unmapped with the last
+// copy of the returned pointer.
+// Note: without mmap, the file is read into an aligned buffer
+inline std::shared_ptr<void> mapFile(const std::string &filename, size_t &size)
+{
+#ifdef SOFTENGINE_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat info;
+    void *data = MAP_FAILED;
+    if(::fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        size = static_cast<size_t>(info.st_size);
+        data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    // Note: the mapping stays valid once the file is closed
+    ::close(fd);
+    if(data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    return std::shared_ptr<void>(data, [size](void *p) { ::munmap(p, size); });
+#else
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if(!file || file.tellg() <= 0)
+    {
+        return nullptr;
+    }
+    size = static_cast<size_t>(file.tellg());
+    MeshBuffer<char> buffer(size);
+    file.seekg(0);
+    if(!file.read(buffer.data(), size))
+    {
+        return nullptr;
+    }
+    return buffer.storage();
+#endif
+}
+
+// Meshes of a mesh cache built from the .babylon file source
+// Note: false when the cache is missing, stale or invalid
+inline bool loadMeshCache(const std::string &filename, const std::string &source,
+                          const MeshLoadOptions &options, std::vector<Mesh> &meshes)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if(!sourceStamp(source, sourceSize, sourceTime))
+    {
+        return false;
+    }
+
+    size_t size = 0;
+    const auto file = mapFile(filename, size);
+    if(!file || size < sizeof(MeshCacheHeader))
+    {
+        return false;
+    }
+    auto *bytes = static_cast<char*>(file.get());
+
+    MeshCacheHeader header;
+    std::memcpy(&header, bytes, sizeof(header));
+    if(std::memcmp(header.magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0 ||
+       header.version != meshCacheVersion ||
+       header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+       header.options != options.flags() ||
+       header.entryCount > (size - sizeof(header)) / sizeof(MeshCacheEntry))
+    {
+        return false;
+    }
+
+    // every range read must lie inside the file
+    const auto inside = [size](uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t alignment)
+    {
+        return offset % alignment == 0 && offset <= size &&
+               count <= (size - offset) / elementSize;
+    };
+
+    // the vertices & faces of an entry, where they are mapped
+    const auto readGeometry = [&](const MeshCacheEntry &entry, VertexStreams &vertices, FaceBuffer &faces)
+    {
+        const auto streamCount = entry.hasUV ? 8 : 6;
+        if(entry.vertexCount > size ||
+           !inside(entry.streamsOffset, VertexStreams::paddedSize(entry.vertexCount) * streamCount,
+                   sizeof(float), meshCacheAlignment) ||
+           (entry.indexSize != sizeof(uint16_t) && entry.indexSize != sizeof(uint32_t)) ||
+           !inside(entry.facesOffset, entry.faceCount, 3 * entry.indexSize, entry.indexSize))
+        {
+            return false;
+        }
+
+        vertices.setStreams(file, reinterpret_cast<float*>(bytes + entry.streamsOffset),
+                            entry.vertexCount, entry.hasUV != 0);
+        if(entry.indexSize == sizeof(uint32_t))
+        {
+            faces.faces32 = MeshBuffer<Face32>(file, reinterpret_cast<Face32*>(bytes + entry.facesOffset),
+                                               entry.faceCount);
+        }
+        else
+        {
+            faces.faces16 = MeshBuffer<Face16>(file, reinterpret_cast<Face16*>(bytes + entry.facesOffset),
+                                               entry.faceCount);
+        }
+
+        // the faces are drawn without any check: an index past the vertices
+        // (a corrupted file whose size & time still match) would read out of
+        // the vertex streams, so the whole cache is rejected instead
+        bool valid = true;
+        faces.visit([&](const auto &buffer)
+        {
+            for(const auto &face : buffer)
+            {
+                valid &= face.a < entry.vertexCount && face.b < entry.vertexCount && face.c < entry.vertexCount;
+            }
+        });
+        return valid;
+    };
+
+    std::vector<Mesh> cached;
+    for(uint32_t i = 0; i < header.entryCount; )
+    {
+        MeshCacheEntry entry;
+        std::memcpy(&entry, bytes + sizeof(header) + i++ * sizeof(entry), sizeof(entry));
+        if(entry.lodCount > header.entryCount - i)
+        {
+            return false;
+        }
+
+        Mesh mesh;
+        mesh.position = entry.position;
+        mesh.rotation = entry.rotation;
+        mesh.bounds = entry.bounds;
+        mesh.backFaceCulling = entry.backFaceCulling != 0;
+        if(!readGeometry(entry, mesh.vertices, mesh.faces) ||
+           !inside(entry.textureOffset, entry.textureLength, 1, 1))
+        {
+            return false;
+        }
+        mesh.textureFile.assign(bytes + entry.textureOffset, entry.textureLength);
+
+        mesh.lods.resize(entry.lodCount);
+        for(auto &lod : mesh.lods)
+        {
+            MeshCacheEntry lodEntry;
+            std::memcpy(&lodEntry, bytes + sizeof(header) + i++ * sizeof(lodEntry), sizeof(lodEntry));
+            lod.error = lodEntry.lodError;
+            if(!readGeometry(lodEntry, lod.vertices, lod.faces))
+            {
+                return false;
+            }
+        }
+        cached.push_back(std::move(mesh));
+    }
+
+    loadMeshTextures(cached, std::filesystem::path(source).parent_path());
+    meshes = std::move(cached);
+    return true;
+}
+
+// Saves meshes loaded from the .babylon file source as a mesh cache
+// Note: the cache is written under a temporary name then renamed, so a
+// concurrent run never maps a partly written file
+inline bool saveMeshCache(const std::string &filename, const std::string &source,
+                          const MeshLoadOptions &options, const std::vector<Mesh> &meshes)
+{
+    MeshCacheHeader header{};
+    std::memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+    header.version = meshCacheVersion;
+    header.options = options.flags();
+    if(!sourceStamp(source, header.sourceSize, header.sourceTime))
+    {
+        return false;
+    }
+
+    // the meshes and their levels of detail, in the order of their entries
+    struct Geometry
+    {
+        const VertexStreams *vertices;
+        const FaceBuffer *faces;
+    };
+    std::vector<MeshCacheEntry> entries;
+    std::vector<Geometry> geometries;
+    for(const auto &mesh : meshes)
+    {
+        MeshCacheEntry entry{};
+        entry.position = mesh.position;
+        entry.rotation = mesh.rotation;
+        entry.bounds = mesh.bounds;
+        entry.backFaceCulling = mesh.backFaceCulling;
+        entry.lodCount = static_cast<uint32_t>(mesh.lods.size());
+        entry.textureLength = static_cast<uint32_t>(mesh.textureFile.size());
+        entries.push_back(entry);
+        geometries.push_back({ &mesh.vertices, &mesh.faces });
+
+        for(const auto &lod : mesh.lods)
+        {
+            MeshCacheEntry lodEntry{};
+            lodEntry.lodError = lod.error;
+            entries.push_back(lodEntry);
+            geometries.push_back({ &lod.vertices, &lod.faces });
+        }
+    }
+    header.entryCount = static_cast<uint32_t>(entries.size());
+
+    const auto align = [](uint64_t offset) { return (offset + meshCacheAlignment - 1) / meshCacheAlignment * meshCacheAlignment; };
+
+    uint64_t offset = sizeof(header) + entries.size() * sizeof(MeshCacheEntry);
+    std::string textureFiles;
+    for(const auto &mesh : meshes)
+    {
+        textureFiles += mesh.textureFile;
+    }
+    for(size_t i = 0, names = offset; i < entries.size(); i++)
+    {
+        entries[i].textureOffset = names;
+        names += entries[i].textureLength;
+    }
+    offset += textureFiles.size();
+
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        const auto &vertices = *geometries[i].vertices;
+        const auto &faces = *geometries[i].faces;
+        auto &entry = entries[i];
+        entry.hasUV = vertices.hasUV();
+        entry.indexSize = static_cast<uint32_t>(faces.indexSize());
+        entry.vertexCount = vertices.size();
+        entry.faceCount = faces.size();
+        entry.streamsOffset = align(offset);
+        entry.facesOffset = entry.streamsOffset +
+            vertices.streams().size() * VertexStreams::paddedSize(vertices.size()) * sizeof(float);
+        offset = entry.facesOffset + faces.size() * 3 * entry.indexSize;
+    }
+
+    const auto temporary = filename + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        const auto write = [&](const void *data, uint64_t count)
+        {
+            file.write(static_cast<const char*>(data), static_cast<std::streamsize>(count));
+        };
+        const char zeros[meshCacheAlignment] = {};
+
+        write(&header, sizeof(header));
+        write(entries.data(), entries.size() * sizeof(MeshCacheEntry));
+        write(textureFiles.data(), textureFiles.size());
+        uint64_t written = sizeof(header) + entries.size() * sizeof(MeshCacheEntry) + textureFiles.size();
+        for(size_t i = 0; i < entries.size(); i++)
+        {
+            write(zeros, entries[i].streamsOffset - written);
+            for(const auto *stream : geometries[i].vertices->streams())
+            {
+                write(stream->data(), stream->size() * sizeof(float));
+            }
+            const auto facesSize = entries[i].faceCount * 3 * entries[i].indexSize;
+            geometries[i].faces->visit([&](const auto &faces) { write(faces.data(), facesSize); });
+            written = entries[i].facesOffset + facesSize;
+        }
+
+        if(!file.flush())
+        {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, filename, error);
+    return !error;
+}
+
+// Loads the meshes of a .babylon file from its mesh cache
+// (filename + ".meshcache"), and builds the cache when it is not up to date
+// Note: when the cache cannot be written (e.g. in a read-only directory),
+// the meshes are loaded from the JSON file each time
+inline std::vector<Mesh> loadCachedMesh(const std::string &filename, const MeshLoadOptions &options = {})
+{
+    const auto cacheName = filename + ".meshcache";
+
+    std::vector<Mesh> meshes;
+    if(loadMeshCache(cacheName, filename, options, meshes))
+    {
+        return meshes;
+    }
+
+    meshes = loadJsonMesh(filename, options);
+    if(!saveMeshCache(cacheName, filename, options, meshes))
+    {
+        std::cerr << "Cannot write the mesh cache " << cacheName << std::endl;
+    }
+    return meshes;
+}
+
+// Frustum planes (a, b, c, d) in object space: point p is inside when
+// a*p.x + b*p.y + c*p.z + d >= 0 for all planes
+// Note: there is no far plane. render() uses a far plane closer than the
+// scene, and nothing has ever been clipped against it.
+struct Frustum
+{
+    std::array<glm::vec4, 5> planes;   // left, right, bottom, top, near
+};
+
+// Gribb & Hartmann: the planes are combinations of the rows of the
+// model-view-projection matrix
+// See: https://www.gamedevs.org/uploads/fast-extraction-viewing-frustum-planes-from-world-view-projection-matrix.pdf
+inline Frustum extractFrustum(const glm::mat4x4 &mvpMat)
+{
+    // Note: glm matrices are column-major, m[column][row]
+    const auto row = [&](int r) { return glm::vec4(mvpMat[0][r], mvpMat[1][r], mvpMat[2][r], mvpMat[3][r]); };
+
+    Frustum frustum{{
+        row(3) + row(0),
+        row(3) - row(0),
+        row(3) + row(1),
+        row(3) - row(1),
+        row(3) + row(2)
+    }};
+
+    // normalized, so that the sphere test can compare distances
+    for(auto &plane : frustum.planes)
+    {
+        plane = plane / glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+// False when the mesh bounds are entirely outside the frustum
+// (the sphere test is cheaper, the box test is tighter)
+inline bool isVisible(const Frustum &frustum, const Bounds &bounds)
+{
+    for(const auto &plane : frustum.planes)
+    {
+        const auto normal = glm::vec3(plane);
+        if(glm::dot(normal, bounds.center) + plane.w < -bounds.radius)
+        {
+            return false;
+        }
+
+        // the corner of the box the most inside this plane
+        const glm::vec3 corner(
+            normal.x >= 0 ? bounds.max.x : bounds.min.x,
+            normal.y >= 0 ? bounds.max.y : bounds.min.y,
+            normal.z >= 0 ? bounds.max.z : bounds.min.z
+        );
+        if(glm::dot(normal, corner) + plane.w < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// A presenter is where a finished frame goes when Device::present() is called.
+// The device itself only renders into memory, so it can run without any display.
+class Presenter
+{
+public:
+    virtual ~Presenter() = default;
+
+    // pixels: width*height RGBA_8888 words, line by line
+    virtual void present(const uint32_t *pixels, uint16_t width, uint16_t height) = 0;
+};
+
+#ifdef SOFTENGINE_WITH_SDL
+// Shows each frame in a SDL window
+class SdlPresenter : public Presenter
+{
+public:
+    SdlPresenter(const int winWidth, const int winHeight, bool vsync = true)
+        : m_window( SDL_CreateWindow(
+              "framebuffer",
+              SDL_WINDOWPOS_CENTERED,
+              SDL_WINDOWPOS_CENTERED,
+              winWidth, winHeight, 0) )
+        , m_renderer( SDL_CreateRenderer(
+              m_window, -1,
+              SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0)) )
+        , m_texture( SDL_CreateTexture(
+              m_renderer,
+              SDL_PIXELFORMAT_RGBA8888,
+              SDL_TEXTUREACCESS_STREAMING,
+              winWidth, winHeight) )
+    { }
+
+    ~SdlPresenter() override
+    {
+        SDL_DestroyTexture(m_texture);
+        SDL_DestroyRenderer(m_renderer);
+        SDL_DestroyWindow(m_window);
+    }
+
+    // Note: the whole frame is uploaded at once into a streaming texture,
+    // instead of asking SDL to draw each pixel one by one
+    void present(const uint32_t *pixels, uint16_t width, uint16_t /*height*/) override
+    {
+        SDL_UpdateTexture(m_texture, nullptr,
+                          pixels,
+                          width * sizeof(uint32_t)); // pitch, in bytes
+        SDL_RenderCopy(m_renderer, m_texture, nullptr, nullptr);
+        SDL_RenderPresent(m_renderer);
+    }
+
+private:
+    SDL_Window *m_window;
+    SDL_Renderer *m_renderer;
+    SDL_Texture *m_texture;
+};
+#endif
+
+// Writes a RGBA_8888 frame as a binary PPM image (alpha is dropped)
+// Note: PPM is trivial to write and opens with most image viewers
+inline void savePPM(const std::string &filename, const uint32_t *pixels, uint16_t width, uint16_t height)
+{
+    std::ofstream file(filename, std::ios::binary);
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    std::vector<uint8_t> line(width * 3);
+    for(uint32_t y = 0; y < height; y++)
+    {
+        for(uint32_t x = 0; x < width; x++)
+        {
+            const auto pixel = pixels[x + y*width];
+            line[x*3    ] = static_cast<uint8_t>(pixel >> 24);  // red
+            line[x*3 + 1] = static_cast<uint8_t>(pixel >> 16);  // green
+            line[x*3 + 2] = static_cast<uint8_t>(pixel >>  8);  // blue
+        }
+        file.write(reinterpret_cast<const char*>(line.data()), line.size());
+    }
+}
+
+// Triangle rasterization algorithms, selectable at runtime to compare them
+enum class Rasterizer
+{
+    Scanline,   // sorts the vertices then fills the triangle line by line
+    HalfSpace,  // walks the bounding box and tests each pixel against the 3 edges
+};
+
+// Instruction sets the rasterization kernels can use
+enum class SimdLevel
+{
+    Scalar,
+    SSE41,  // 8x8 pixels blocks, 4 pixels per instruction
+    AVX2,   // 8x8 pixels blocks, 8 pixels per instruction
+};
+
+// Best instruction set supported by the CPU running the engine
+inline SimdLevel detectSimdLevel()
+{
+#ifdef SOFTENGINE_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return SimdLevel::SSE41;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// Name of an instruction set, as given on the command lines
+inline const char* simdLevelName(SimdLevel simd)
+{
+    switch(simd)
+    {
+        case SimdLevel::AVX2:  return "avx2";
+        case SimdLevel::SSE41: return "sse4";
+        case SimdLevel::Scalar: break;
+    }
+    return "scalar";
+}
+
+// Hierarchical Z: besides the depth buffer, the nearest (min) and farthest (max)
+// depths of each block of 8x8 pixels, so that whole blocks can be rejected, or
+// drawn without per pixel depth test, before touching their pixels.
+// Note: depths only decrease during a frame, so a stale max (or a lowered min)
+// stays conservative; the block kernels refresh both when they draw a block
+constexpr int hizBlockSize = 8;
+
+// Memory the rasterization kernels draw into
+struct RenderTarget
+{
+    uint32_t *color;    // RGBA_8888
+
+    // Deferred shading: when set, the kernels write the id of the triangle
+    // covering each pixel here (see TriangleSetup::id), instead of its color
+    uint32_t *visibility;
+
+    float *depth;
+    int width;
+    int height;
+
+    float *hizMin;      // one per block of hizBlockSize x hizBlockSize pixels
+    float *hizMax;
+    int hizWidth;       // number of blocks per line
+
+    uint64_t *shadedPixels; // incremented by the pixels written (statistics)
+};
+
+// Visibility buffer value of the pixels no triangle covers
+constexpr uint32_t noTriangle = 0xffffffff;
+
+// Screen coordinates are snapped to 28.4 fixed-point (1/16 pixel) before
+// rasterization, so that edges shared by two triangles are evaluated exactly
+// the same way for both, whatever the order of their vertices
+constexpr int subpixelBits = 4;
+constexpr int subpixelScale = 1 << subpixelBits;
+
+inline int32_t toFixed(float v)
+{
+    return static_cast<int32_t>(std::lround(v * subpixelScale));
+}
+
+inline float snapToSubpixel(float v)
+{
+    return static_cast<float>(toFixed(v)) / subpixelScale;
+}
+
+// floor(log2(v)) of a positive float, from its exponent
+// Note: -127 for 0, 128 for infinity & NaN
+inline int floorLog2(float v)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    return static_cast<int>((bits >> 23) & 0xff) - 127;
+}
+
+// The 4 texels around (u, v) on a level, and the weights between them
+// Note: the texture repeats outside [0, 1], and texel centers are at half
+// texel coordinates
+struct BilinearFootprint
+{
+    uint32_t t00, t10, t01, t11;    // texel (x, y), (x+1, y), (x, y+1) & (x+1, y+1)
+    float fx;                       // weight of the second column
+    float fy;                       // weight of the second line
+};
+
+inline BilinearFootprint bilinearFootprint(const Texture &texture, int level, float u, float v)
+{
+    const int width = texture.levelWidth(level);
+    const int height = texture.levelHeight(level);
+
+    // wrapped to [0, 1] first, so that the texel coordinates stay small:
+    // x in [-0.5, width - 0.5], where floor(x) = int(x + 1) - 1
+    const float x = (u - std::floor(u)) * width - 0.5f;
+    const float y = (v - std::floor(v)) * height - 0.5f;
+    const int x0 = static_cast<int>(x + 1.0f) - 1;
+    const int y0 = static_cast<int>(y + 1.0f) - 1;
+
+    // -1 is the last texel, and the one after the last is the first
+    const unsigned tx0 = x0 < 0 ? width - 1 : x0;
+    const unsigned ty0 = y0 < 0 ? height - 1 : y0;
+    const unsigned tx1 = x0 + 1 == width ? 0 : x0 + 1;
+    const unsigned ty1 = y0 + 1 == height ? 0 : y0 + 1;
+
+    const uint32_t *texels = texture.levelTexels(level);
+    const size_t column0 = Texture::columnOffset(tx0), column1 = Texture::columnOffset(tx1);
+    const size_t line0 = texture.lineOffset(level, ty0), line1 = texture.lineOffset(level, ty1);
+    return {
+        texels[column0 + line0], texels[column1 + line0],
+        texels[column0 + line1], texels[column1 + line1],
+        x - x0,
+        y - y0
+    };
+}
+
+// Bilinear filtering, times scale (e.g. the light), channel by channel
+// Note: the SIMD version does exactly the same operations, 4 channels at once
+inline uint32_t filterBilinearScalar(const BilinearFootprint &f, float scale)
+{
+    uint32_t color = 0;
+    for(int shift = 0; shift < 32; shift += 8)
+    {
+        const auto channel = [shift](uint32_t t) { return static_cast<float>((t >> shift) & 0xff); };
+        const float top    = channel(f.t00) + (channel(f.t10) - channel(f.t00)) * f.fx;
+        const float bottom = channel(f.t01) + (channel(f.t11) - channel(f.t01)) * f.fx;
+        const float value  = (top + (bottom - top) * f.fy) * scale;
+        color |= static_cast<uint32_t>(std::min(value + 0.5f, 255.0f)) << shift;
+    }
+    return color;
+}
+
+#ifdef SOFTENGINE_X86_SIMD
+// One texel, its 4 channels in the 4 lanes, in the order of its bytes in memory
+__attribute__((target("sse4.1")))
+inline __m128 unpackTexel(uint32_t t)
+{
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(t))));
+}
+
+__attribute__((target("sse4.1")))
+inline uint32_t filterBilinearSSE41(const BilinearFootprint &f, float scale)
+{
+    const __m128 fx = _mm_set1_ps(f.fx);
+    const __m128 t00 = unpackTexel(f.t00);
+    const __m128 t01 = unpackTexel(f.t01);
+    const __m128 top    = _mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(unpackTexel(f.t10), t00), fx));
+    const __m128 bottom = _mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(unpackTexel(f.t11), t01), fx));
+    const __m128 value  = _mm_mul_ps(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), _mm_set1_ps(f.fy))),
+                                     _mm_set1_ps(scale));
+
+    // rounded to the nearest (the channels are positive), then saturated down to bytes
+    const __m128i channels = _mm_cvttps_epi32(_mm_add_ps(value, _mm_set1_ps(0.5f)));
+    const __m128i words = _mm_packus_epi32(channels, channels);
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(words, words)));
+}
+#endif
+
+// Color of the pixel (x, y) of a textured triangle, as RGBA_8888, times light
+// The mipmap level is the one whose texels are about the size of the pixel:
+// rho, the largest of the lengths in texels of the pixel's sides mapped on
+// the texture, is computed from the derivatives of u = (u/w) / (1/w) along X
+// & Y, and the level is log2(rho), rounded to the nearest.
+// Note: round(log2(rho)) = floor((floor(log2(rho²)) + 1) / 2), which only
+// needs the exponent of rho²
+inline uint32_t shadeTexel(const TextureMapping &m, int x, int y, float light, SimdLevel simd)
+{
+    const auto &texture = *m.texture;
+    const float w = 1.0f / m.oneOverW.at(x, y);
+    const float u = m.uOverW.at(x, y) * w;
+    const float v = m.vOverW.at(x, y) * w;
+
+    // d(u/w / 1/w)/dx = (d(u/w)/dx - u * d(1/w)/dx) * w, & so on, in texels of the level 0
+    const float width = static_cast<float>(texture.width());
+    const float height = static_cast<float>(texture.height());
+    const float dudx = (m.uOverW.dx - u * m.oneOverW.dx) * w * width;
+    const float dvdx = (m.vOverW.dx - v * m.oneOverW.dx) * w * height;
+    const float dudy = (m.uOverW.dy - u * m.oneOverW.dy) * w * width;
+    const float dvdy = (m.vOverW.dy - v * m.oneOverW.dy) * w * height;
+    const float rho2 = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+    const int level = std::clamp((floorLog2(rho2) + 1) >> 1, 0, texture.levelCount() - 1);
+
+    const auto footprint = bilinearFootprint(texture, level, u, v);
+#ifdef SOFTENGINE_X86_SIMD
+    if(simd != SimdLevel::Scalar)
+    {
+        return filterBilinearSSE41(footprint, light);
+    }
+#else
+    (void)simd;
+#endif
+    return filterBilinearScalar(footprint, light);
+}
+
+// Everything the rasterization kernels need to know about a triangle,
+// computed once per triangle (see Device::setupTriangle)
+struct TriangleSetup
+{
+    // edge functions E(x,y) = a*x + b*y + c at the center of pixel (x,y),
+    // in 1/256 of pixel², positive or zero inside the triangle
+    // Note: c already holds the fill rule bias (see Device::setupTriangle)
+    int32_t a[3];
+    int32_t b[3];
+    int64_t c[3];
+
+    // when the edge functions may overflow 32 bits on the bounding box,
+    // only the (64 bits) scalar kernel can draw the triangle
+    bool wide;
+
+    // Z plane equation at the center of pixel (x,y): z(x,y) = dzdx*x + dzdy*y + z0
+    float dzdx;
+    float dzdy;
+    float z0;
+
+    uint32_t color;     // color of the material, RGBA_8888, before lighting
+
+    // Gouraud shading: the light of the 3 vertices, interpolated on screen
+    ScreenPlane light = { 0.0f, 0.0f, 1.0f };
+
+    // textured triangles only: the texture, used instead of color
+    TextureMapping mapping = {};
+
+    // deferred shading: what is written to the visibility buffer, the index
+    // of this setup in the frame's triangles (see Device::rasterizeTiles)
+    uint32_t id = 0;
+
+    // bounding box (inclusive), clipped to the render target
+    int minX;
+    int minY;
+    int maxX;
+    int maxY;
+};
+
+// Color c, as RGBA_8888, times light (clamped to [0, 1])
+// Note: the channels are truncated, the same as the tutorial's flat shading
+inline uint32_t litColor(uint32_t c, float light)
+{
+    light = std::clamp(light, 0.0f, 1.0f);
+    return (static_cast<uint32_t>(static_cast<float>(c >> 24) * light) << 24) |
+           (static_cast<uint32_t>(static_cast<float>((c >> 16) & 0xff) * light) << 16) |
+           (static_cast<uint32_t>(static_cast<float>((c >> 8) & 0xff) * light) << 8) |
+            static_cast<uint32_t>(static_cast<float>(c & 0xff) * light);
+}
+
+// Color of the pixel (x, y) of a triangle: its color or its texture, lit
+// by the light interpolated at the pixel's center
+inline uint32_t shadePixel(const TriangleSetup &t, int x, int y, SimdLevel simd)
+{
+    const float light = std::clamp(t.light.at(x, y), 0.0f, 1.0f);
+    return t.mapping.texture ? shadeTexel(t.mapping, x, y, light, simd) : litColor(t.color, light);
+}
+
+inline int64_t edgeAt(const TriangleSetup &t, int i, int x, int y)
+{
+    return t.c[i] + static_cast<int64_t>(t.a[i]) * x + static_cast<int64_t>(t.b[i]) * y;
+}
+
+// True when the triangle cannot cover any pixel center of the block
+// [x0, x0+size) x [y0, y0+size): one edge is negative on the 4 corners
+inline bool blockOutside(const TriangleSetup &t, int x0, int y0, int size)
+{
+    for(int i = 0; i < 3; i++)
+    {
+        // the corner where the edge function is the biggest
+        const int64_t maxE = edgeAt(t, i, x0, y0)
+                           + std::max<int64_t>(0, static_cast<int64_t>(t.a[i]) * (size - 1))
+                           + std::max<int64_t>(0, static_cast<int64_t>(t.b[i]) * (size - 1));
+        if(maxE < 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Nearest & farthest depths of the width x height pixels from depth,
+// whose lines are stride pixels apart
+inline void blockDepthRange(const float *depth, int stride, int width, int height, float &zMin, float &zMax)
+{
+    zMin = std::numeric_limits<float>::max();
+    zMax = 0;
+    for(int y = 0; y < height; y++, depth += stride)
+    {
+        for(int x = 0; x < width; x++)
+        {
+            zMin = std::min(zMin, depth[x]);
+            zMax = std::max(zMax, depth[x]);
+        }
+    }
+}
+
+// What the hierarchical Z tells about a triangle on a block
+enum class DepthTest
+{
+    Reject,     // behind everything already drawn in the block
+    Skip,       // in front of everything in the block: no per pixel test needed
+    Test,       // per pixel depth test
+};
+
+inline DepthTest hizTest(const TriangleSetup &t, const RenderTarget &rt, int bx, int by)
+{
+    // Z range of the triangle's plane on the block's pixel centers
+    // Note: not narrowed down to the vertices' Z range, the plane evaluated
+    // at a pixel center may round slightly past it
+    const float span = static_cast<float>(hizBlockSize - 1);
+    const float z = t.dzdx * bx + t.dzdy * by + t.z0;
+    const float zMin = z + std::min(0.0f, t.dzdx * span) + std::min(0.0f, t.dzdy * span);
+    const float zMax = z + std::max(0.0f, t.dzdx * span) + std::max(0.0f, t.dzdy * span);
+
+    const auto hiz = bx / hizBlockSize + (by / hizBlockSize) * rt.hizWidth;
+    if(zMin > rt.hizMax[hiz])
+    {
+        return DepthTest::Reject;
+    }
+    if(zMax <= rt.hizMin[hiz])
+    {
+        return DepthTest::Skip;
+    }
+    return DepthTest::Test;
+}
+
+// Reference kernel on one block, one pixel at a time, with 64 bits edge functions
+// Note: it handles the blocks crossing the target's border, so the SIMD
+// kernels use it for those too.
+inline void rasterizeBlockScalar(const TriangleSetup &t, const RenderTarget &rt, int bx, int by, DepthTest test)
+{
+    const int endX = std::min(bx + hizBlockSize, rt.width);
+    const int endY = std::min(by + hizBlockSize, rt.height);
+
+    float zMin = std::numeric_limits<float>::max();
+    float zMax = 0;
+    uint64_t shaded = 0;
+    for(int y = by; y < endY; y++)
+    {
+        int64_t e1 = edgeAt(t, 0, bx, y);
+        int64_t e2 = edgeAt(t, 1, bx, y);
+        int64_t e3 = edgeAt(t, 2, bx, y);
+
+        for(int x = bx; x < endX; x++)
+        {
+            // Note: Z is evaluated at each pixel, never stepped, so that all
+            // the kernels compute exactly the same depths (see rasterize)
+            const float z = t.dzdx * x + t.dzdy * y + t.z0;
+            const auto idx = x + y*rt.width;
+            if((e1 | e2 | e3) >= 0 &&
+               (test == DepthTest::Skip || z <= rt.depth[idx]))
+            {
+                rt.depth[idx] = z;
+                if(rt.visibility)
+                {
+                    rt.visibility[idx] = t.id;
+                }
+                else
+                {
+                    rt.color[idx] = shadePixel(t, x, y, SimdLevel::Scalar);
+                }
+                shaded++;
+            }
+
+            zMin = std::min(zMin, rt.depth[idx]);
+            zMax = std::max(zMax, rt.depth[idx]);
+
+            e1 += t.a[0];
+            e2 += t.a[1];
+            e3 += t.a[2];
+        }
+    }
+
+    const auto hiz = bx / hizBlockSize + (by / hizBlockSize) * rt.hizWidth;
+    rt.hizMin[hiz] = zMin;
+    rt.hizMax[hiz] = zMax;
+    *rt.shadedPixels += shaded;
+}
+
+// Walks the bounding box by blocks, rejecting the blocks outside the triangle
+// or hidden according to the hierarchical Z
+inline void rasterizeScalar(const TriangleSetup &t, const RenderTarget &rt)
+{
+    constexpr int block = hizBlockSize;
+    for(int by = t.minY & ~(block-1); by <= t.maxY; by += block)
+    {
+        for(int bx = t.minX & ~(block-1); bx <= t.maxX; bx += block)
+        {
+            if(blockOutside(t, bx, by, block))
+            {
+                continue;
+            }
+
+            const auto test = hizTest(t, rt, bx, by);
+            if(test != DepthTest::Reject)
+            {
+                rasterizeBlockScalar(t, rt, bx, by, test);
+            }
+        }
+    }
+}
+
+#ifdef SOFTENGINE_X86_SIMD
+__attribute__((target("sse4.1")))
+inline float horizontalMin(__m128 v)
+{
+    v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_min_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse4.1")))
+inline float horizontalMax(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+// The lowest byte of value, times light, on 4 lanes
+__attribute__((target("sse4.1")))
+inline __m128i litChannel4(uint32_t value, __m128 light)
+{
+    return _mm_cvttps_epi32(_mm_mul_ps(_mm_set1_ps(static_cast<float>(value & 0xff)), light));
+}
+
+__attribute__((target("avx2")))
+inline __m256i litChannel8(uint32_t value, __m256 light)
+{
+    return _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_set1_ps(static_cast<float>(value & 0xff)), light));
+}
+
+// Same as blockDepthRange, on a whole hierarchical Z block
+__attribute__((target("sse4.1")))
+inline void blockDepthRangeSSE41(const float *depth, int stride, float &zMin, float &zMax)
+{
+    __m128 lo = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128 hi = _mm_setzero_ps();
+    for(int y = 0; y < hizBlockSize; y++, depth += stride)
+    {
+        for(int x = 0; x < hizBlockSize; x += 4)
+        {
+            const __m128 d = _mm_loadu_ps(depth + x);
+            lo = _mm_min_ps(lo, d);
+            hi = _mm_max_ps(hi, d);
+        }
+    }
+    zMin = horizontalMin(lo);
+    zMax = horizontalMax(hi);
+}
+
+// Colors of the pixels (x, y) to (x+3, y), at xs & ys (see shadePixel),
+// only shaded where mask is set
+// Note: untextured, the light & the color are computed on the 4 lanes at
+// once, with the same operations as litColor
+__attribute__((target("sse4.1")))
+inline __m128 shadePixels4(const TriangleSetup &t, int x, int y, __m128 xs, __m128 ys, __m128 mask)
+{
+    if(t.mapping.texture)
+    {
+        alignas(16) uint32_t colors[4] = {};
+        const int lanes = _mm_movemask_ps(mask);
+        for(int k = 0; k < 4; k++)
+        {
+            if(lanes & (1 << k))
+            {
+                colors[k] = shadePixel(t, x + k, y, SimdLevel::SSE41);
+            }
+        }
+        return _mm_load_ps(reinterpret_cast<const float*>(colors));
+    }
+
+    const __m128 plane = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.light.dx), xs),
+                                               _mm_mul_ps(_mm_set1_ps(t.light.dy), ys)),
+                                    _mm_set1_ps(t.light.c0));
+    const __m128 light = _mm_min_ps(_mm_max_ps(plane, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    const __m128i color = _mm_or_si128(
+        _mm_or_si128(_mm_slli_epi32(litChannel4(t.color >> 24, light), 24), _mm_slli_epi32(litChannel4(t.color >> 16, light), 16)),
+        _mm_or_si128(_mm_slli_epi32(litChannel4(t.color >> 8, light), 8), litChannel4(t.color, light)));
+    return _mm_castsi128_ps(color);
+}
+
+// Same as shadePixels4, for the pixels (x, y) to (x+7, y)
+__attribute__((target("avx2")))
+inline __m256 shadePixels8(const TriangleSetup &t, int x, int y, __m256 xs, __m256 ys, __m256 mask)
+{
+    if(t.mapping.texture)
+    {
+        alignas(32) uint32_t colors[8] = {};
+        const int lanes = _mm256_movemask_ps(mask);
+        for(int k = 0; k < 8; k++)
+        {
+            if(lanes & (1 << k))
+            {
+                colors[k] = shadePixel(t, x + k, y, SimdLevel::AVX2);
+            }
+        }
+        return _mm256_load_ps(reinterpret_cast<const float*>(colors));
+    }
+
+    const __m256 plane = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(t.light.dx), xs),
+                                                     _mm256_mul_ps(_mm256_set1_ps(t.light.dy), ys)),
+                                       _mm256_set1_ps(t.light.c0));
+    const __m256 light = _mm256_min_ps(_mm256_max_ps(plane, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    const __m256i color = _mm256_or_si256(
+        _mm256_or_si256(_mm256_slli_epi32(litChannel8(t.color >> 24, light), 24), _mm256_slli_epi32(litChannel8(t.color >> 16, light), 16)),
+        _mm256_or_si256(_mm256_slli_epi32(litChannel8(t.color >> 8, light), 8), litChannel8(t.color, light)));
+    return _mm256_castsi256_ps(color);
+}
+
+// Same as rasterizeScalar, each block line being drawn as 2 x 4 pixels:
+// the edge functions (in 32 bits) and Z are evaluated, depth tested and
+// colors (or triangle ids) blended for 4 pixels at once
+// Note: a pixel is inside when the sign bits of its 3 edge functions are clear
+__attribute__((target("sse4.1")))
+inline void rasterizeSSE41(const TriangleSetup &t, const RenderTarget &rt)
+{
+    constexpr int block = hizBlockSize;
+    const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    const __m128 allSet = _mm_castsi128_ps(minusOne);
+    const __m128 id = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(t.id)));
+    uint32_t *output = rt.visibility ? rt.visibility : rt.color;
+
+    const __m128i laneE1 = _mm_setr_epi32(0, t.a[0], 2*t.a[0], 3*t.a[0]);
+    const __m128i laneE2 = _mm_setr_epi32(0, t.a[1], 2*t.a[1], 3*t.a[1]);
+    const __m128i laneE3 = _mm_setr_epi32(0, t.a[2], 2*t.a[2], 3*t.a[2]);
+    const __m128i stepE1 = _mm_set1_epi32(t.b[0]);
+    const __m128i stepE2 = _mm_set1_epi32(t.b[1]);
+    const __m128i stepE3 = _mm_set1_epi32(t.b[2]);
+    uint64_t shaded = 0;
+
+    for(int by = t.minY & ~(block-1); by <= t.maxY; by += block)
+    {
+        for(int bx = t.minX & ~(block-1); bx <= t.maxX; bx += block)
+        {
+            if(blockOutside(t, bx, by, block))
+            {
+                continue;
+            }
+
+            const auto test = hizTest(t, rt, bx, by);
+            if(test == DepthTest::Reject)
+            {
+                continue;
+            }
+
+            // blocks crossing the border of the target are drawn pixel by pixel
+            if(bx + block > rt.width || by + block > rt.height)
+            {
+                rasterizeBlockScalar(t, rt, bx, by, test);
+                continue;
+            }
+
+            __m128 zMin = _mm_set1_ps(std::numeric_limits<float>::max());
+            __m128 zMax = zero;
+            for(int half = 0; half < block; half += 4)
+            {
+                const int x0 = bx + half;
+                const __m128 xs = _mm_add_ps(_mm_set1_ps(static_cast<float>(x0)), laneOffsets);
+                const __m128 zx = _mm_mul_ps(_mm_set1_ps(t.dzdx), xs);
+
+                // the edge functions of the first line, stepped by b on each next line
+                __m128i e1 = _mm_add_epi32(_mm_set1_epi32(static_cast<int32_t>(edgeAt(t, 0, x0, by))), laneE1);
+                __m128i e2 = _mm_add_epi32(_mm_set1_epi32(static_cast<int32_t>(edgeAt(t, 1, x0, by))), laneE2);
+                __m128i e3 = _mm_add_epi32(_mm_set1_epi32(static_cast<int32_t>(edgeAt(t, 2, x0, by))), laneE3);
+
+                for(int y = by; y < by + block; y++)
+                {
+                    const __m128 ys = _mm_set1_ps(static_cast<float>(y));
+                    const __m128 z  = _mm_add_ps(_mm_add_ps(zx, _mm_mul_ps(_mm_set1_ps(t.dzdy), ys)), _mm_set1_ps(t.z0));
+
+                    const auto idx = x0 + y*rt.width;
+                    float *depthPtr = rt.depth + idx;
+                    float *colorPtr = reinterpret_cast<float*>(output + idx);
+                    __m128 depth = _mm_loadu_ps(depthPtr);
+
+                    const __m128 inside = _mm_castsi128_ps(_mm_cmpgt_epi32(
+                        _mm_or_si128(_mm_or_si128(e1, e2), e3), minusOne));
+                    if(_mm_movemask_ps(inside) != 0)
+                    {
+                        const __m128 pass = (test == DepthTest::Skip) ? allSet : _mm_cmple_ps(z, depth);
+                        const __m128 mask = _mm_and_ps(inside, pass);
+
+                        depth = _mm_blendv_ps(depth, z, mask);
+                        _mm_storeu_ps(depthPtr, depth);
+                        const __m128 shadedColor = rt.visibility ? id : shadePixels4(t, x0, y, xs, ys, mask);
+                        _mm_storeu_ps(colorPtr, _mm_blendv_ps(_mm_loadu_ps(colorPtr), shadedColor, mask));
+                        shaded += __builtin_popcount(_mm_movemask_ps(mask));
+                    }
+
+                    zMin = _mm_min_ps(zMin, depth);
+                    zMax = _mm_max_ps(zMax, depth);
+
+                    e1 = _mm_add_epi32(e1, stepE1);
+                    e2 = _mm_add_epi32(e2, stepE2);
+                    e3 = _mm_add_epi32(e3, stepE3);
+                }
+            }
+
+            const auto hiz = bx / block + (by / block) * rt.hizWidth;
+            rt.hizMin[hiz] = horizontalMin(zMin);
+            rt.hizMax[hiz] = horizontalMax(zMax);
+        }
+    }
+    *rt.shadedPixels += shaded;
+}
+
+// Same as rasterizeScalar, with a whole block line (8 pixels) at once
+__attribute__((target("avx2")))
+inline void rasterizeAVX2(const TriangleSetup &t, const RenderTarget &rt)
+{
+    constexpr int block = hizBlockSize;
+    const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    const __m256 allSet = _mm256_castsi256_ps(minusOne);
+    const __m256 id = _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(t.id)));
+    uint32_t *output = rt.visibility ? rt.visibility : rt.color;
+
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i laneE1 = _mm256_mullo_epi32(_mm256_set1_epi32(t.a[0]), lanes);
+    const __m256i laneE2 = _mm256_mullo_epi32(_mm256_set1_epi32(t.a[1]), lanes);
+    const __m256i laneE3 = _mm256_mullo_epi32(_mm256_set1_epi32(t.a[2]), lanes);
+    const __m256i stepE1 = _mm256_set1_epi32(t.b[0]);
+    const __m256i stepE2 = _mm256_set1_epi32(t.b[1]);
+    const __m256i stepE3 = _mm256_set1_epi32(t.b[2]);
+    uint64_t shaded = 0;
+
+    for(int by = t.minY & ~(block-1); by <= t.maxY; by += block)
+    {
+        for(int bx = t.minX & ~(block-1); bx <= t.maxX; bx += block)
+        {
+            if(blockOutside(t, bx, by, block))
+            {
+                continue;
+            }
+
+            const auto test = hizTest(t, rt, bx, by);
+            if(test == DepthTest::Reject)
+            {
+                continue;
+            }
+
+            // blocks crossing the border of the target are drawn pixel by pixel
+            if(bx + block > rt.width || by + block > rt.height)
+            {
+                rasterizeBlockScalar(t, rt, bx, by, test);
+                continue;
+            }
+
+            const __m256 xs = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(bx)), laneOffsets);
+
+            // the edge functions of the first line, stepped by b on each next line
+            __m256i e1 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(edgeAt(t, 0, bx, by))), laneE1);
+            __m256i e2 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(edgeAt(t, 1, bx, by))), laneE2);
+            __m256i e3 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(edgeAt(t, 2, bx, by))), laneE3);
+            const __m256 zx = _mm256_mul_ps(_mm256_set1_ps(t.dzdx), xs);
+
+            __m256 zMin = _mm256_set1_ps(std::numeric_limits<float>::max());
+            __m256 zMax = zero;
+            for(int y = by; y < by + block; y++)
+            {
+                const __m256 ys = _mm256_set1_ps(static_cast<float>(y));
+                const __m256 z  = _mm256_add_ps(_mm256_add_ps(zx, _mm256_mul_ps(_mm256_set1_ps(t.dzdy), ys)), _mm256_set1_ps(t.z0));
+
+                const auto idx = bx + y*rt.width;
+                float *depthPtr = rt.depth + idx;
+                float *colorPtr = reinterpret_cast<float*>(output + idx);
+                __m256 depth = _mm256_loadu_ps(depthPtr);
+
+                const __m256 inside = _mm256_castsi256_ps(_mm256_cmpgt_epi32(
+                    _mm256_or_si256(_mm256_or_si256(e1, e2), e3), minusOne));
+
+                if(_mm256_movemask_ps(inside) != 0)
+                {
+                    const __m256 pass = (test == DepthTest::Skip) ? allSet : _mm256_cmp_ps(z, depth, _CMP_LE_OQ);
+                    const __m256 mask = _mm256_and_ps(inside, pass);
+
+                    depth = _mm256_blendv_ps(depth, z, mask);
+                    _mm256_storeu_ps(depthPtr, depth);
+                    const __m256 shadedColor = rt.visibility ? id : shadePixels8(t, bx, y, xs, ys, mask);
+                    _mm256_storeu_ps(colorPtr, _mm256_blendv_ps(_mm256_loadu_ps(colorPtr), shadedColor, mask));
+                    shaded += __builtin_popcount(_mm256_movemask_ps(mask));
+                }
+
+                zMin = _mm256_min_ps(zMin, depth);
+                zMax = _mm256_max_ps(zMax, depth);
+
+                e1 = _mm256_add_epi32(e1, stepE1);
+                e2 = _mm256_add_epi32(e2, stepE2);
+                e3 = _mm256_add_epi32(e3, stepE3);
+            }
+
+            const auto hiz = bx / block + (by / block) * rt.hizWidth;
+            rt.hizMin[hiz] = horizontalMin(_mm_min_ps(_mm256_castps256_ps128(zMin), _mm256_extractf128_ps(zMin, 1)));
+            rt.hizMax[hiz] = horizontalMax(_mm_max_ps(_mm256_castps256_ps128(zMax), _mm256_extractf128_ps(zMax, 1)));
+        }
+    }
+    *rt.shadedPixels += shaded;
+}
+#endif
+
+// Runs the best kernel available for the given instruction set
+// Note: whichever it is, the pixels, depths & colors written are the same
+inline void rasterize(const TriangleSetup &t, const RenderTarget &rt, SimdLevel simd)
+{
+#ifdef SOFTENGINE_X86_SIMD
+    switch(t.wide ? SimdLevel::Scalar : simd)
+    {
+        case SimdLevel::AVX2:
+            rasterizeAVX2(t, rt);
+            return;
+        case SimdLevel::SSE41:
+            rasterizeSSE41(t, rt);
+            return;
+        case SimdLevel::Scalar:
+            break;
+    }
+#else
+    (void)simd;
+#endif
+    rasterizeScalar(t, rt);
+}
+
+// Deferred shading: colors of the count pixels (x, y) to (x+count-1, y) of
+// a triangle, written to out (see Device::shadeTile)
+#ifdef SOFTENGINE_X86_SIMD
+// Same as shadeSpan, 4 pixels at a time, returns the number of pixels shaded
+__attribute__((target("sse4.1")))
+inline int shadeSpanSSE41(const TriangleSetup &t, int x, int y, int count, uint32_t *out)
+{
+    const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 ys = _mm_set1_ps(static_cast<float>(y));
+    const __m128 allSet = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    int k = 0;
+    for(; k + 4 <= count; k += 4)
+    {
+        const __m128 xs = _mm_add_ps(_mm_set1_ps(static_cast<float>(x + k)), laneOffsets);
+        _mm_storeu_ps(reinterpret_cast<float*>(out + k), shadePixels4(t, x + k, y, xs, ys, allSet));
+    }
+    return k;
+}
+
+// Same as shadeSpan, 8 pixels at a time, returns the number of pixels shaded
+__attribute__((target("avx2")))
+inline int shadeSpanAVX2(const TriangleSetup &t, int x, int y, int count, uint32_t *out)
+{
+    const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 ys = _mm256_set1_ps(static_cast<float>(y));
+    const __m256 allSet = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    int k = 0;
+    for(; k + 8 <= count; k += 8)
+    {
+        const __m256 xs = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x + k)), laneOffsets);
+        _mm256_storeu_ps(reinterpret_cast<float*>(out + k), shadePixels8(t, x + k, y, xs, ys, allSet));
+    }
+    return k;
+}
+#endif
+
+inline void shadeSpan(const TriangleSetup &t, int x, int y, int count, uint32_t *out, SimdLevel simd)
+{
+    int k = 0;
+#ifdef SOFTENGINE_X86_SIMD
+    switch(simd)
+    {
+        case SimdLevel::AVX2:
+            k = shadeSpanAVX2(t, x, y, count, out);
+            break;
+        case SimdLevel::SSE41:
+            k = shadeSpanSSE41(t, x, y, count, out);
+            break;
+        case SimdLevel::Scalar:
+            break;
+    }
+#endif
+    // the remaining pixels, one at a time
+    for(; k < count; k++)
+    {
+        out[k] = shadePixel(t, x + k, y, simd);
+    }
+}
+
+// Matrices of the batched vertex transform, computed once per mesh
+struct VertexTransform
+{
+    glm::mat4x4 mvpv;       // model-view, projection & viewport at once: object -> screen (before the perspective divide)
+    glm::mat4x4 mv;         // model-view: object -> 3D world
+    glm::mat3x3 normalMat;  // inverse transpose of the model-view, for the normals
+};
+
+// The viewport transform of glm::project, as a matrix:
+// [-1, 1] -> [0, width] & [0, height], and Z: [-1, 1] -> [0, 1]
+inline glm::mat4x4 viewportMatrix(int width, int height)
+{
+    glm::mat4x4 viewportMat(1.0f);
+    viewportMat[0][0] = width  * 0.5f;
+    viewportMat[1][1] = height * 0.5f;
+    viewportMat[2][2] = 0.5f;
+    viewportMat[3][0] = width  * 0.5f;
+    viewportMat[3][1] = height * 0.5f;
+    viewportMat[3][2] = 0.5f;
+    return viewportMat;
+}
+
+// Merges the whole chain of glm::project into a single matrix
+inline VertexTransform makeVertexTransform(const glm::mat4x4 &mvMat, const glm::mat4x4 &projMat,
+                                    int width, int height)
+{
+    return {
+        viewportMatrix(width, height) * projMat * mvMat,
+        mvMat,
+        glm::transpose(glm::inverse(glm::mat3x3(mvMat)))
+    };
+}
+
+// Reference implementation, one vertex at a time on [begin, end)
+inline void transformVerticesScalar(const VertexStreams &in, const VertexTransform &t,
+                             Vertex *out, size_t begin, size_t end)
+{
+    for(size_t i = begin; i < end; i++)
+    {
+        const auto p = glm::vec4(in.x[i], in.y[i], in.z[i], 1.0f);
+        const auto screen = t.mvpv * p;
+        const auto world = t.mv * p;
+
+        // Note: multiplying by the inverse of w, as the SIMD versions do
+        out[i].coordinates = glm::vec3(screen) * (1.0f / screen.w);
+        out[i].worldCoordinates = glm::vec3(world);
+        out[i].normal = t.normalMat * in.normal(i);
+        out[i].clip = screen;
+        out[i].uv = in.hasUV() ? glm::vec2(in.u[i], in.v[i]) : glm::vec2(0.0f);
+    }
+}
+
+#ifdef SOFTENGINE_X86_SIMD
+// Row r of mat * (x, y, z, 1), on 4 vertices at once
+// Note: glm matrices are column-major, mat[column][row]
+__attribute__((target("sse4.1")))
+inline __m128 matRow4(const glm::mat4x4 &mat, int r, __m128 x, __m128 y, __m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mat[0][r]), x),
+                                 _mm_mul_ps(_mm_set1_ps(mat[1][r]), y)),
+                      _mm_add_ps(_mm_mul_ps(_mm_set1_ps(mat[2][r]), z),
+                                 _mm_set1_ps(mat[3][r])));
+}
+
+// Row r of mat * (x, y, z, 1), on 8 vertices at once
+__attribute__((target("avx2")))
+inline __m256 matRow8(const glm::mat4x4 &mat, int r, __m256 x, __m256 y, __m256 z)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(mat[0][r]), x),
+                                       _mm256_mul_ps(_mm256_set1_ps(mat[1][r]), y)),
+                         _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(mat[2][r]), z),
+                                       _mm256_set1_ps(mat[3][r])));
+}
+
+// The matrix-vector products, on 4 vertices at once
+// Note: the streams are padded, so reading a whole register is always valid,
+// but only the real vertices are written back
+__attribute__((target("sse4.1")))
+inline void transformVerticesSSE41(const VertexStreams &in, const VertexTransform &t, Vertex *out)
+{
+    constexpr size_t lanes = 4;
+    const auto &m = t.mvpv;
+    const auto &w = t.mv;
+    const auto &n = t.normalMat;
+
+    alignas(16) float result[13][lanes];
+    for(size_t i = 0; i < in.size(); i += lanes)
+    {
+        const __m128 x = _mm_load_ps(&in.x[i]);
+        const __m128 y = _mm_load_ps(&in.y[i]);
+        const __m128 z = _mm_load_ps(&in.z[i]);
+
+        const __m128 clipX = matRow4(m, 0, x, y, z);
+        const __m128 clipY = matRow4(m, 1, x, y, z);
+        const __m128 clipZ = matRow4(m, 2, x, y, z);
+        const __m128 clipW = matRow4(m, 3, x, y, z);
+        const __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), clipW);
+        _mm_store_ps(result[0], _mm_mul_ps(clipX, invW));
+        _mm_store_ps(result[1], _mm_mul_ps(clipY, invW));
+        _mm_store_ps(result[2], _mm_mul_ps(clipZ, invW));
+        _mm_store_ps(result[9],  clipX);
+        _mm_store_ps(result[10], clipY);
+        _mm_store_ps(result[11], clipZ);
+        _mm_store_ps(result[12], clipW);
+        _mm_store_ps(result[3], matRow4(w, 0, x, y, z));
+        _mm_store_ps(result[4], matRow4(w, 1, x, y, z));
+        _mm_store_ps(result[5], matRow4(w, 2, x, y, z));
+
+        const __m128 nx = _mm_load_ps(&in.nx[i]);
+        const __m128 ny = _mm_load_ps(&in.ny[i]);
+        const __m128 nz = _mm_load_ps(&in.nz[i]);
+        for(int r = 0; r < 3; r++)
+        {
+            _mm_store_ps(result[6 + r],
+                         _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(n[0][r]), nx),
+                                               _mm_mul_ps(_mm_set1_ps(n[1][r]), ny)),
+                                    _mm_mul_ps(_mm_set1_ps(n[2][r]), nz)));
+        }
+
+        const auto count = std::min(lanes, in.size() - i);
+        for(size_t k = 0; k < count; k++)
+        {
+            out[i + k] = {
+                { result[0][k], result[1][k], result[2][k] },
+                { result[3][k], result[4][k], result[5][k] },
+                { result[6][k], result[7][k], result[8][k] },
+                { result[9][k], result[10][k], result[11][k], result[12][k] },
+                in.hasUV() ? glm::vec2(in.u[i + k], in.v[i + k]) : glm::vec2(0.0f)
+            };
+        }
+    }
+}
+
+// Same as transformVerticesSSE41, on 8 vertices at once
+__attribute__((target("avx2")))
+inline void transformVerticesAVX2(const VertexStreams &in, const VertexTransform &t, Vertex *out)
+{
+    constexpr size_t lanes = 8;
+    const auto &m = t.mvpv;
+    const auto &w = t.mv;
+    const auto &n = t.normalMat;
+
+    alignas(32) float result[13][lanes];
+    for(size_t i = 0; i < in.size(); i += lanes)
+    {
+        const __m256 x = _mm256_load_ps(&in.x[i]);
+        const __m256 y = _mm256_load_ps(&in.y[i]);
+        const __m256 z = _mm256_load_ps(&in.z[i]);
+
+        const __m256 clipX = matRow8(m, 0, x, y, z);
+        const __m256 clipY = matRow8(m, 1, x, y, z);
+        const __m256 clipZ = matRow8(m, 2, x, y, z);
+        const __m256 clipW = matRow8(m, 3, x, y, z);
+        const __m256 invW = _mm256_div_ps(_mm256_set1_ps(1.0f), clipW);
+        _mm256_store_ps(result[0], _mm256_mul_ps(clipX, invW));
+        _mm256_store_ps(result[1], _mm256_mul_ps(clipY, invW));
+        _mm256_store_ps(result[2], _mm256_mul_ps(clipZ, invW));
+        _mm256_store_ps(result[9],  clipX);
+        _mm256_store_ps(result[10], clipY);
+        _mm256_store_ps(result[11], clipZ);
+        _mm256_store_ps(result[12], clipW);
+        _mm256_store_ps(result[3], matRow8(w, 0, x, y, z));
+        _mm256_store_ps(result[4], matRow8(w, 1, x, y, z));
+        _mm256_store_ps(result[5], matRow8(w, 2, x, y, z));
+
+        const __m256 nx = _mm256_load_ps(&in.nx[i]);
+        const __m256 ny = _mm256_load_ps(&in.ny[i]);
+        const __m256 nz = _mm256_load_ps(&in.nz[i]);
+        for(int r = 0; r < 3; r++)
+        {
+            _mm256_store_ps(result[6 + r],
+                            _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(n[0][r]), nx),
+                                                        _mm256_mul_ps(_mm256_set1_ps(n[1][r]), ny)),
+                                          _mm256_mul_ps(_mm256_set1_ps(n[2][r]), nz)));
+        }
+
+        const auto count = std::min(lanes, in.size() - i);
+        for(size_t k = 0; k < count; k++)
+        {
+            out[i + k] = {
+                { result[0][k], result[1][k], result[2][k] },
+                { result[3][k], result[4][k], result[5][k] },
+                { result[6][k], result[7][k], result[8][k] },
+                { result[9][k], result[10][k], result[11][k], result[12][k] },
+                in.hasUV() ? glm::vec2(in.u[i + k], in.v[i + k]) : glm::vec2(0.0f)
+            };
+        }
+    }
+}
+#endif
+
+// Transforms all the vertices of a mesh into out (which must hold in.size() vertices)
+// with the best implementation available for the given instruction set
+inline void transformVertices(const VertexStreams &in, const VertexTransform &t, Vertex *out, SimdLevel simd)
+{
+#ifdef SOFTENGINE_X86_SIMD
+    switch(simd)
+    {
+        case SimdLevel::AVX2:
+            transformVerticesAVX2(in, t, out);
+            return;
+        case SimdLevel::SSE41:
+            transformVerticesSSE41(in, t, out);
+            return;
+        case SimdLevel::Scalar:
+            break;
+    }
+#else
+    (void)simd;
+#endif
+    transformVerticesScalar(in, t, out, 0, in.size());
+}
+
+// Frame timeline: scoped timers around the stages of a frame, recorded per
+// thread and written as a Chrome trace (open it in chrome://tracing or
+// https://ui.perfetto.dev) to see where the time of a slow frame went.
+// Note: only compiled with SOFTENGINE_TRACE (see CMakeLists.txt), otherwise
+// SOFTENGINE_TRACE_SCOPE expands to nothing and costs nothing
+#ifdef SOFTENGINE_TRACE
+// One timed scope, in nanoseconds since the start of the trace
+struct TraceEvent
+{
+    const char *name;   // Note: a string literal, never copied
+    int64_t begin;
+    int64_t end;
+};
+
+inline int64_t traceClock()
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// The last events of one thread: a ring buffer written by its thread only,
+// so recording an event takes no lock. The oldest events are overwritten.
+// Note: the events are read while no frame is being rendered (e.g. after
+// render() returned); a reader racing with the writer could see a torn event
+class TraceBuffer
+{
+public:
+    static constexpr size_t capacity = 1 << 16;    // events, a power of 2
+
+    explicit TraceBuffer(unsigned threadId) : m_threadId(threadId), m_events(capacity) {}
+
+    unsigned threadId() const { return m_threadId; }
+
+    void record(const TraceEvent &event)
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        m_events[head & (capacity - 1)] = event;
+        // publishes the event before the new head
+        m_head.store(head + 1, std::memory_order_release);
+    }
+
+    // Calls f(event) on the events still in the buffer, oldest first
+    template<typename F>
+    void forEach(F f) const
+    {
+        const auto head = m_head.load(std::memory_order_acquire);
+        for(auto i = head - std::min<uint64_t>(head, capacity); i < head; i++)
+        {
+            f(m_events[i & (capacity - 1)]);
+        }
+    }
+
+private:
+    const unsigned m_threadId;
+    std::vector<TraceEvent> m_events;
+    std::atomic<uint64_t> m_head{0};
+};
+
+// The buffers of all the threads which recorded events
+// Note: a thread's buffer is kept when it exits, with its events, and given
+// to the next new thread, so that the threads of the TaskPools replaced by
+// Device::setThreadCount don't each leave a buffer behind
+struct TraceRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+    std::vector<TraceBuffer*> unused;   // of the exited threads
+
+    static TraceRegistry& instance()
+    {
+        static TraceRegistry registry;
+        return registry;
+    }
+};
+
+// Holds the buffer of a thread while it runs
+// (the only times the registry's lock is taken: its first event and its exit)
+class TraceThreadBuffer
+{
+public:
+    TraceThreadBuffer()
+    {
+        auto &registry = TraceRegistry::instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        if(!registry.unused.empty())
+        {
+            m_buffer = registry.unused.back();
+            registry.unused.pop_back();
+            return;
+        }
+        registry.buffers.push_back(std::make_unique<TraceBuffer>(static_cast<unsigned>(registry.buffers.size())));
+        m_buffer = registry.buffers.back().get();
+    }
+    ~TraceThreadBuffer()
+    {
+        auto &registry = TraceRegistry::instance();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.unused.push_back(m_buffer);
+    }
+
+    TraceThreadBuffer(const TraceThreadBuffer&) = delete;
+    TraceThreadBuffer& operator=(const TraceThreadBuffer&) = delete;
+
+    TraceBuffer& buffer() { return *m_buffer; }
+
+private:
+    TraceBuffer *m_buffer;
+};
+
+// Buffer of the calling thread, taken at its first event
+inline TraceBuffer& traceBuffer()
+{
+    thread_local TraceThreadBuffer buffer;
+    return buffer.buffer();
+}
+
+// Times its own lifetime
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : m_name(name), m_begin(traceClock()) {}
+    ~TraceScope() { traceBuffer().record({ m_name, m_begin, traceClock() }); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char *m_name;
+    int64_t m_begin;
+};
+
+// All the recorded events in the Chrome trace_event format:
+// one complete event ("ph": "X") per scope, timestamps in microseconds
+// See: https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+inline tao::json::value chromeTrace()
+{
+    tao::json::value events = tao::json::empty_array;
+
+    auto &registry = TraceRegistry::instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for(const auto &buffer : registry.buffers)
+    {
+        const auto tid = buffer->threadId();
+        events.push_back({
+            { "name", "thread_name" },
+            { "ph", "M" },
+            { "pid", 1 },
+            { "tid", tid },
+            { "args", { { "name", "thread " + std::to_string(tid) } } }
+        });
+        buffer->forEach([&](const TraceEvent &event)
+        {
+            events.push_back({
+                { "name", event.name },
+                { "ph", "X" },
+                { "pid", 1 },
+                { "tid", tid },
+                { "ts", event.begin / 1000.0 },
+                { "dur", (event.end - event.begin) / 1000.0 }
+            });
+        });
+    }
+
+    return {
+        { "traceEvents", std::move(events) },
+        { "displayTimeUnit", "ms" }
+    };
+}
+
+inline void saveChromeTrace(const std::string &filename)
+{
+    std::ofstream file(filename);
+    tao::json::to_stream(file, chromeTrace());
+    file << std::endl;
+}
+
+#define SOFTENGINE_TRACE_CONCAT2(a, b) a##b
+#define SOFTENGINE_TRACE_CONCAT(a, b) SOFTENGINE_TRACE_CONCAT2(a, b)
+#define SOFTENGINE_TRACE_SCOPE(name) const TraceScope SOFTENGINE_TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define SOFTENGINE_TRACE_SCOPE(name) ((void)0)
+#endif
+
+// Runs batches of independent tasks on a fixed set of threads.
+// Each worker owns a queue of tasks; once its queue is empty, it steals tasks
+// from the back of the other workers' queues, so that expensive tasks
+// (e.g. crowded screen tiles) do not leave the other threads idle.
+class TaskPool
+{
+public:
+    // Note: the calling thread is one of the workers, so a pool of
+    // 1 thread runs everything on the caller, without any extra thread
+    explicit TaskPool(unsigned threadCount)
+    {
+        threadCount = std::max(1u, threadCount);
+        for(unsigned i = 0; i < threadCount; i++)
+        {
+            m_queues.push_back(std::make_unique<WorkQueue>());
+        }
+        for(unsigned i = 1; i < threadCount; i++)
+        {
+            m_threads.emplace_back(&TaskPool::workerLoop, this, i);
+        }
+    }
+
+    ~TaskPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for(auto &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    unsigned threadCount() const { return static_cast<unsigned>(m_queues.size()); }
+
+    // Calls job(i) for each i in [0, count) and returns once they are all done
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)> &job)
+    {
+        if(count == 0)
+        {
+            return;
+        }
+
+        // Note: the job must be set before any task is visible in the queues
+        m_job = &job;
+        m_remaining = count;
+
+        // dealing the tasks round-robin, stealing balances the load afterwards
+        for(uint32_t i = 0; i < count; i++)
+        {
+            auto &queue = *m_queues[i % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(i);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        runTasks(0);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_remaining == 0; });
+    }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    void workerLoop(unsigned self)
+    {
+        uint64_t generation = 0;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&] { return m_stop || m_generation != generation; });
+                if(m_stop)
+                {
+                    return;
+                }
+                generation = m_generation;
+            }
+            runTasks(self);
+        }
+    }
+
+    // Runs tasks until there is nothing left anywhere
+    void runTasks(unsigned self)
+    {
+        uint32_t task;
+        while(popTask(self, task))
+        {
+            (*m_job)(task);
+
+            if(--m_remaining == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.notify_all();
+            }
+        }
+    }
+
+    // Own tasks are taken from the front, stolen ones from the back
+    bool popTask(unsigned self, uint32_t &task)
+    {
+        const auto count = m_queues.size();
+        for(size_t i = 0; i < count; i++)
+        {
+            auto &queue = *m_queues[(self + i) % count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.tasks.empty())
+            {
+                continue;
+            }
+
+            if(i == 0)
+            {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;   // one per worker
+    std::vector<std::thread> m_threads;
+
+    const std::function<void(uint32_t)> *m_job = nullptr;
+    std::atomic<uint32_t> m_remaining{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+class Device
+{
+public:
+    // Without presenter, the device renders offscreen only:
+    // frames stay in memory and can be read back with colorBuffer()
+    Device(const int winWidth, const int winHeight,
+           std::unique_ptr<Presenter> presenter = nullptr)
+        : m_winWidth(winWidth)
+        , m_winHeight(winHeight)
+        , m_presenter(std::move(presenter))
+        , m_colorBuffer(m_winWidth * m_winHeight, 0)
+        , m_depthBuffer(m_winWidth * m_winHeight, std::numeric_limits<float>::max())
+        , m_hizWidth((m_winWidth + hizBlockSize - 1) / hizBlockSize)
+        , m_hizHeight((m_winHeight + hizBlockSize - 1) / hizBlockSize)
+        , m_hizMin(m_hizWidth * m_hizHeight, std::numeric_limits<float>::max())
+        , m_hizMax(m_hizWidth * m_hizHeight, std::numeric_limits<float>::max())
+        , m_hizStale(m_hizWidth * m_hizHeight, false)
+        , m_taskPool(std::make_unique<TaskPool>(std::thread::hardware_concurrency()))
+    {
+        setTileSize(64);
+    }
+
+    uint16_t width()  const { return m_winWidth;  }
+    uint16_t height() const { return m_winHeight; }
+
+    // Note: both resolve the tiles cleared but not drawn yet (see clear())
+    const std::vector<uint32_t>& colorBuffer() { resolveColor(); return m_colorBuffer; }
+    const std::vector<float>&    depthBuffer() { resolveDepth(); return m_depthBuffer; }
+
+    Rasterizer rasterizer() const { return m_rasterizer; }
+    void setRasterizer(Rasterizer rasterizer) { m_rasterizer = rasterizer; }
+
+    // Threads rasterizing the screen tiles (half-space rasterizer only)
+    unsigned threadCount() const { return m_taskPool->threadCount(); }
+    void setThreadCount(unsigned threadCount)
+    {
+        m_taskPool = std::make_unique<TaskPool>(threadCount);
+    }
+
+    // Size in pixels of the square screen tiles the triangles are binned into
+    // Note: rounded up to a multiple of the biggest SIMD block (8 pixels),
+    // so that a block never overlaps two tiles
+    int tileSize() const { return m_tileSize; }
+    void setTileSize(int tileSize)
+    {
+        // pending clears are tracked per tile, flushed before changing the tiles
+        resolveColor();
+        resolveDepth();
+
+        m_tileSize = std::max(8, (tileSize + 7) & ~7);
+        m_tilesX = (m_winWidth  + m_tileSize - 1) / m_tileSize;
+        m_tilesY = (m_winHeight + m_tileSize - 1) / m_tileSize;
+        m_bins.assign(m_tilesX * m_tilesY, {});
+        m_tileStates.assign(m_tilesX * m_tilesY, {});
+    }
+
+    // Instruction set used by the vertex stage and the half-space rasterizer
+    // Note: it cannot go beyond what the CPU supports
+    SimdLevel simdLevel() const { return m_simdLevel; }
+    void setSimdLevel(SimdLevel simd) { m_simdLevel = std::min(simd, detectSimdLevel()); }
+
+    // What the last render() did
+    struct FrameStats
+    {
+        uint32_t meshes;        // drawn, after frustum & occlusion culling
+        uint64_t triangles;     // reaching the rasterizer, after culling & clipping
+        uint64_t pixels;        // written: inside a triangle & passing the depth test
+        uint64_t shaded;        // colors computed: the same as pixels, except
+                                // with deferred shading, only the visible ones
+    };
+    const FrameStats& stats() const { return m_stats; }
+
+    // Skipping the meshes hidden behind bigger ones (see cullOccludedMeshes)
+    bool occlusionCulling() const { return m_occlusionCulling; }
+    void setOcclusionCulling(bool enabled) { m_occlusionCulling = enabled; }
+
+    // Deferred shading (half-space rasterizer only): the triangles are first
+    // rasterized into a visibility buffer, holding the id of the nearest
+    // triangle at each pixel, then each tile is shaded from it. A pixel is
+    // shaded once, whatever the number of triangles drawn over it, which
+    // pays off when shading costs more than writing an id (textures).
+    // Note: the triangle ids index the frame's triangle setups, which hold
+    // everything needed to shade: the light & texture coordinates planes,
+    // and the mesh's color & texture
+    bool deferredShading() const { return m_deferredShading; }
+    void setDeferredShading(bool enabled)
+    {
+        m_deferredShading = enabled;
+        m_visibilityBuffer.assign(enabled ? m_winWidth * m_winHeight : 0, noTriangle);
+    }
+
+    // Largest error on screen, in pixels, of the level of detail drawn for
+    // a mesh (see selectLod); 0 always draws the full meshes
+    float lodThreshold() const { return m_lodThreshold; }
+    void setLodThreshold(float pixels) { m_lodThreshold = std::max(0.0f, pixels); }
+
+    // This method is called to clear the back buffer with a specific color
+    // Note: nothing is written here, the tiles are only flagged as cleared.
+    // A tile is really cleared the first time a triangle is drawn into it,
+    // and the tiles never drawn are resolved when the frame is read back.
+    // Tiles still holding the cleared values from a previous frame are not
+    // written again at all.
+    void clear(color4 c)
+    {
+        SOFTENGINE_TRACE_SCOPE("clear");
+        m_clearColor = toRGBA8888(c);
+        for(auto &state : m_tileStates)
+        {
+            state.cleared = true;
+        }
+    }
+
+    // Once everything is ready, we can flush the back buffer into the front buffer
+    // Note: offscreen, there is no front buffer and this does nothing
+    void present()
+    {
+        SOFTENGINE_TRACE_SCOPE("present");
+        if(m_presenter)
+        {
+            resolveColor();
+            m_presenter->present(m_colorBuffer.data(), m_winWidth, m_winHeight);
+        }
+    }
+
+    // DrawPoint calls PutPixel but does the clipping operation before
+    void drawPoint(glm::vec3 p, color4 c)
+    {
+        if(p.x >= 0 && p.y >= 0 &&
+           p.x < m_winWidth &&
+           p.y < m_winHeight      )
+        {
+            const auto x = static_cast<uint16_t>(p.x);
+            const auto y = static_cast<uint16_t>(p.y);
+
+            // Note: a tile still to be cleared is cleared before the point is drawn,
+            // else the lazy clear would erase the point when the frame is read back
+            prepareTile(x / m_tileSize + (y / m_tileSize) * m_tilesX);
+            putPixel(x, y, p.z, c);
+        }
+    }
+
+    /* TODO: to be updated
+    void drawLine(glm::vec2 p0, glm::vec2 p1)
+    {
+        // Bresenham's line algorithm
+        // https://en.wikipedia.org/wiki/Bresenham's_line_algorithm
+
+              auto x0 = static_cast<uint16_t>(p0.x);
+              auto y0 = static_cast<uint16_t>(p0.y);
+        const auto x1 = static_cast<uint16_t>(p1.x);
+        const auto y1 = static_cast<uint16_t>(p1.y);
+
+        const auto dx = std::abs(x1 - x0);
+        const auto dy = std::abs(y1 - y0);
+        const auto sx = (x0 < x1) ? 1 : -1;
+        const auto sy = (y0 < y1) ? 1 : -1;
+        auto err = dx - dy;
+
+        while (true) {
+            drawPoint(glm::vec2(x0, y0), {255, 255, 255, 255});
+
+            if ((x0 == x1) && (y0 == y1)) break;
+            const auto e2 = 2 * err;
+            if (e2 > -dy) { err -= dy; x0 += sx; }
+            if (e2 < dx) { err += dx; y0 += sy; }
+        }
+    }
+    */
+
+    // drawing line between 2 points from left to right
+    // papb -> pcpd
+    // pa, pb, pc, pd must then be sorted before
+    // Note: "processScanLine" can be seen as a "pixel shader"
+    void processScanline(ScanLineData data,
+                         Vertex va, Vertex vb, Vertex vc, Vertex vd,
+                         color4 c)
+    {
+        const auto pa = va.coordinates;
+        const auto pb = vb.coordinates;
+        const auto pc = vc.coordinates;
+        const auto pd = vd.coordinates;
+
+        // Thanks to current Y, we can compute the gradient to compute others values like
+        // the starting X (xa) and ending X (xb) to draw between
+        // if pa.Y == pb.Y or pc.Y == pd.Y, gradient is forced to 1
+        // Note: everything is evaluated at the pixels' center
+        const auto y = data.currentY;
+        const float centerY = y + 0.5f;
+        const auto gradient1 = (pa.y != pb.y) ? (centerY - pa.y) / (pb.y - pa.y) : 1;
+        const auto gradient2 = (pc.y != pd.y) ? (centerY - pc.y) / (pd.y - pc.y) : 1;
+
+        // Note: std::lerp for "interpolate"
+        // See: https://en.cppreference.com/w/cpp/numeric/lerp
+        const float xa = std::lerp(pa.x, pb.x, gradient1);
+        const float xb = std::lerp(pc.x, pd.x, gradient2);
+
+        // the pixels whose center is in [xa, xb[
+        const int sx = static_cast<int>(std::ceil(xa - 0.5f));
+        const int ex = static_cast<int>(std::ceil(xb - 0.5f));
+
+        // drawing a line from left (sx) to right (ex)
+        // Note: only the part inside the viewport
+        const int startX = std::max(sx, 0);
+        const int endX = std::min(ex, static_cast<int>(m_winWidth));
+
+        // Z & the light at the first pixel, then one addition per pixel
+        // Note: unlike the half-space kernels, each pixel is depth tested: on
+        // spans of a few pixels, skipping the test costs more than it saves
+        float z = data.z.at(startX, y);
+        float nDotL = data.nDotL.at(startX, y);
+        for(int x = startX; x < endX; x++, z += data.z.dx, nDotL += data.nDotL.dx)
+        {
+            // the sums may step slightly out of [0, 1] on the triangle's edges
+            const float light = std::clamp(nDotL, 0.0f, 1.0f);
+
+            // Note: the span is inside the viewport and drawTriangle has
+            // prepared its tiles, so the pixels are put directly
+            if(data.mapping.texture)
+            {
+                putPixel(x, y, z,
+                         fromRGBA8888(shadeTexel(data.mapping, x, y, light, m_simdLevel)));
+                continue;
+            }
+
+            // changing the color value using the cosine of the angle
+            // between the light vector and the normal vector
+            putPixel(
+                x, y, z,
+                { c.r * light, c.g * light, c.b * light, c.a * light }
+            );
+        }
+    }
+
+    // Compute the cosine of the angle between the light vector and the normal vector
+    // Returns a value between 0 and 1
+    float computeNDotL(glm::vec3 vertex, glm::vec3 normal, glm::vec3 lightPosition)
+    {
+        auto lightDirection = lightPosition - vertex;
+
+        normal = glm::normalize(normal);
+        lightDirection = glm::normalize(lightDirection);
+
+        return std::max(0.0f, glm::dot(normal, lightDirection));
+    }
+
+    // Note: with a texture, the vertices' texture coordinates are mapped on
+    // it, and c is not used
+    void drawTriangle(Vertex v1, Vertex v2, Vertex v3, color4 c, const Texture *texture = nullptr)
+    {
+        m_stats.triangles++;
+
+        // Both rasterizers work on coordinates snapped to 1/16 of pixel
+        // (see toFixed), so that shared edges are the same for both triangles
+        for(auto *v : { &v1, &v2, &v3 })
+        {
+            v->coordinates.x = snapToSubpixel(v->coordinates.x);
+            v->coordinates.y = snapToSubpixel(v->coordinates.y);
+        }
+
+        // Sorting the points in order to always have this order on screen p1, p2 & p3
+        // with p1 always up (thus having the Y the lowest possible to be near the top screen)
+        // then p2 between p1 & p3
+        // Note: 'pX' became 'vX'
+        if(v1.coordinates.y > v2.coordinates.y)
+        {
+            const auto temp = v2;
+            v2 = v1;
+            v1 = temp;
+        }
+
+        if(v2.coordinates.y > v3.coordinates.y)
+        {
+            const auto temp = v2;
+            v2 = v3;
+            v3 = temp;
+        }
+
+        if(v1.coordinates.y > v2.coordinates.y)
+        {
+            const auto temp = v2;
+            v2 = v1;
+            v1 = temp;
+        }
+
+        const auto p1 = v1.coordinates;
+        const auto p2 = v2.coordinates;
+        const auto p3 = v3.coordinates;
+
+        // Light position
+        const auto lightPos = glm::vec3(0, 10, 10);
+        // TODO: read this from scene file
+        // computing the cos of the angle between the light vector and the normal vector
+        // it will return a value between 0 and 1 that will be used as the intensity of the color
+        // Note: Gouraud shading, it is computed for each vertex, then
+        // interpolated between them, instead of once for the face's center
+        const glm::vec3 nDotL(computeNDotL(v1.worldCoordinates, v1.normal, lightPos),
+                              computeNDotL(v2.worldCoordinates, v2.normal, lightPos),
+                              computeNDotL(v3.worldCoordinates, v3.normal, lightPos));
+
+        // Note: in half-space mode, triangles are only queued here, and
+        // rasterized tile by tile at the end of render() (see rasterizeTiles)
+        if(m_rasterizer == Rasterizer::HalfSpace)
+        {
+            TriangleSetup t;
+            if(setupTriangle(v1, v2, v3, nDotL, c, t, texture))
+            {
+                m_triangles.push_back(t);
+            }
+            return;
+        }
+
+        ScanLineData data{
+            0,
+            screenPlane(p1, p2, p3, nDotL[0], nDotL[1], nDotL[2]),
+            screenPlane(p1, p2, p3, p1.z, p2.z, p3.z),
+            {}
+        };
+        if(texture)
+        {
+            data.mapping = textureMapping(v1, v2, v3, texture);
+        }
+
+        // Is P2 on the right or on the left of the P1-P3 line?
+        // Note: the tutorial compares the inverse slopes of P1-P2 & P1-P3,
+        // which cannot tell when P1-P2 is horizontal
+        const float p2Side = (p2.x - p1.x) * (p3.y - p1.y) - (p2.y - p1.y) * (p3.x - p1.x);
+
+        // only the lines inside the viewport, whose pixel center is in [p1.y, p3.y[
+        // Note: with the same rule on X (see processScanline), a pixel center
+        // exactly on an edge is only drawn for top & left edges
+        const int startY = std::max(0, static_cast<int>(std::ceil(p1.y - 0.5f)));
+        const int endY   = std::min(m_winHeight - 1, static_cast<int>(std::ceil(p3.y - 0.5f)) - 1);
+
+        // the whole triangle is skipped when it is behind what is already drawn
+        const int startX = std::max(0, static_cast<int>(std::floor(std::min({p1.x, p2.x, p3.x}))));
+        const int endX   = std::min(m_winWidth - 1, static_cast<int>(std::max({p1.x, p2.x, p3.x})));
+        if(startY > endY || startX > endX)
+        {
+            return;
+        }
+
+        for(int ty = startY / m_tileSize; ty <= endY / m_tileSize; ty++)
+        {
+            for(int tx = startX / m_tileSize; tx <= endX / m_tileSize; tx++)
+            {
+                prepareTile(tx + ty*m_tilesX);
+            }
+        }
+
+        if(isOccluded(std::min({p1.z, p2.z, p3.z}), startX, startY, endX, endY))
+        {
+            return;
+        }
+        const auto pixelsBefore = m_stats.pixels;
+
+        // First case where triangles are like that:
+        // P1
+        // -
+        // --
+        // - -
+        // -  -
+        // -   - P2
+        // -  -
+        // - -
+        // -
+        // P3
+        if(p2Side > 0)
+        {
+            for(int y = startY; y <= endY; y++)
+            {
+                data.currentY = y;
+
+                if(y + 0.5f < p2.y)
+                {
+                    processScanline(data, v1, v3, v1, v2, c);
+                }
+                else
+                {
+                    processScanline(data, v1, v3, v2, v3, c);
+                }
+            }
+        }
+        // Second case where triangles are like that:
+        //       P1
+        //        -
+        //       --
+        //      - -
+        //     -  -
+        // P2 -   -
+        //     -  -
+        //      - -
+        //        -
+        //       P3
+        else
+        {
+            for(int y = startY; y <= endY; y++)
+            {
+                data.currentY = y;
+
+                if(y + 0.5f < p2.y)
+                {
+                    processScanline(data, v1, v2, v1, v3, c);
+                }
+                else
+                {
+                    processScanline(data, v2, v3, v1, v3, c);
+                }
+            }
+        }
+
+        // Note: a triangle entirely hidden changed nothing
+        if(m_stats.pixels != pixelsBefore)
+        {
+            markHizStale(startX, startY, endX, endY);
+        }
+    }
+
+    // Half-space rasterization: a pixel is inside the triangle when it is on
+    // the inner side of its 3 edges. Each edge function E(x,y) = A*x + B*y + C
+    // is linear, so walking the bounding box only needs additions (no division
+    // per pixel), and Z is interpolated the same way with the plane equation.
+    // See: https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
+    // Note: this only sets the triangle up, pixels are drawn by the kernels
+    // matching the instruction set selected with setSimdLevel()
+    // Returns false when the triangle covers nothing on screen
+    bool setupTriangle(const Vertex &v1, const Vertex &v2, const Vertex &v3,
+                       glm::vec3 nDotL, color4 c, TriangleSetup &t,
+                       const Texture *texture = nullptr) const
+    {
+        t.mapping = texture ? textureMapping(v1, v2, v3, texture) : TextureMapping{};
+        t.light = screenPlane(v1.coordinates, v2.coordinates, v3.coordinates, nDotL[0], nDotL[1], nDotL[2]);
+        t.color = toRGBA8888(c);
+
+        return setupTriangle(v1.coordinates, v2.coordinates, v3.coordinates,
+                             m_winWidth, m_winHeight, t);
+    }
+
+    // Edges, Z plane & bounding box only, on a width x height target
+    // Note: the edge functions are computed exactly, in integers, from the
+    // coordinates snapped to 28.4 fixed-point. A pixel center exactly on an
+    // edge belongs to the triangle only if it is a top or a left edge (the
+    // "top-left" fill rule), so each pixel along an edge shared by two
+    // triangles is drawn exactly once.
+    static bool setupTriangle(const glm::vec3 &p1, const glm::vec3 &p2, const glm::vec3 &p3,
+                              int width, int height, TriangleSetup &t)
+    {
+        const int64_t x1 = toFixed(p1.x), y1 = toFixed(p1.y);
+        const int64_t x2 = toFixed(p2.x), y2 = toFixed(p2.y);
+        const int64_t x3 = toFixed(p3.x), y3 = toFixed(p3.y);
+
+        // twice the signed area of the triangle
+        int64_t area = (x2 - x1) * (y3 - y1) - (y2 - y1) * (x3 - x1);
+        if(area == 0)
+        {
+            return false; // degenerated triangle, nothing to draw
+        }
+
+        // edge functions coefficients, edge N is opposite to vertex N
+        // (so that E1/area, E2/area, E3/area are the barycentric coordinates)
+        int64_t a[3] = { y2 - y3, y3 - y1, y1 - y2 };
+        int64_t b[3] = { x3 - x2, x1 - x3, x2 - x1 };
+        int64_t c[3] = { x2 * y3 - y2 * x3, x3 * y1 - y3 * x1, x1 * y2 - y1 * x2 };
+
+        // no culling here: whatever the winding, flip the signs so that
+        // the inside of the triangle is always positive
+        if(area < 0)
+        {
+            for(int i = 0; i < 3; i++)
+            {
+                a[i] = -a[i];
+                b[i] = -b[i];
+                c[i] = -c[i];
+            }
+            area = -area;
+        }
+
+        const float z[3] = { p1.z, p2.z, p3.z };
+        double dzdx = 0, dzdy = 0, z0 = 0;
+        for(int i = 0; i < 3; i++)
+        {
+            // from one pixel center to the next: 1 pixel = subpixelScale units
+            t.a[i] = static_cast<int32_t>(a[i] * subpixelScale);
+            t.b[i] = static_cast<int32_t>(b[i] * subpixelScale);
+            const int64_t center = c[i] + (a[i] + b[i]) * (subpixelScale / 2);
+
+            dzdx += static_cast<double>(t.a[i]) * z[i];
+            dzdy += static_cast<double>(t.b[i]) * z[i];
+            z0   += static_cast<double>(center) * z[i];
+
+            // top-left fill rule: on the other edges, zero is outside
+            // Note: the inside is where the edge function grows, so a left edge
+            // has a > 0, and a top edge (horizontal, Y growing downwards in
+            // memory) has a = 0 & b > 0
+            const bool topLeft = a[i] > 0 || (a[i] == 0 && b[i] > 0);
+            t.c[i] = topLeft ? center : center - 1;
+        }
+        t.dzdx = static_cast<float>(dzdx / area);
+        t.dzdy = static_cast<float>(dzdy / area);
+        t.z0   = static_cast<float>(z0 / area);
+
+        t.minX = std::max(0, static_cast<int>(std::floor(std::min({p1.x, p2.x, p3.x}))));
+        t.minY = std::max(0, static_cast<int>(std::floor(std::min({p1.y, p2.y, p3.y}))));
+        t.maxX = std::min(width  - 1, static_cast<int>(std::ceil(std::max({p1.x, p2.x, p3.x}))));
+        t.maxY = std::min(height - 1, static_cast<int>(std::ceil(std::max({p1.y, p2.y, p3.y}))));
+        if(t.minX > t.maxX || t.minY > t.maxY)
+        {
+            return false;
+        }
+
+        // the SIMD kernels use 32 bits edge functions: they must fit on all the
+        // blocks the bounding box overlaps (the extremes are on the corners),
+        // with some margin (see Device::drawOccluders)
+        const int xs[2] = { t.minX & ~(hizBlockSize-1), t.maxX | (hizBlockSize-1) };
+        const int ys[2] = { t.minY & ~(hizBlockSize-1), t.maxY | (hizBlockSize-1) };
+        t.wide = false;
+        for(int i = 0; i < 3; i++)
+        {
+            for(const int x : xs)
+            {
+                for(const int y : ys)
+                {
+                    const auto e = edgeAt(t, i, x, y);
+                    t.wide |= e >= (int64_t(1) << 30) || e <= -(int64_t(1) << 30);
+                }
+            }
+        }
+        return true;
+    }
+
+    // Sort-middle rasterization: each queued triangle is binned into the
+    // screen tiles its bounding box overlaps, then the tiles are rasterized
+    // in parallel. A tile is drawn by one thread only, so threads never
+    // touch the same pixels, and within a tile triangles keep their order.
+    void rasterizeTiles()
+    {
+        {
+            SOFTENGINE_TRACE_SCOPE("binning");
+            for(auto &bin : m_bins)
+            {
+                bin.clear();
+            }
+
+            for(uint32_t i = 0; i < m_triangles.size(); i++)
+            {
+                const auto &t = m_triangles[i];
+                for(int ty = t.minY / m_tileSize; ty <= t.maxY / m_tileSize; ty++)
+                {
+                    for(int tx = t.minX / m_tileSize; tx <= t.maxX / m_tileSize; tx++)
+                    {
+                        m_bins[tx + ty*m_tilesX].push_back(i);
+                    }
+                }
+            }
+        }
+
+        SOFTENGINE_TRACE_SCOPE("rasterization");
+        std::atomic<uint64_t> drawnPixels{0};
+        std::atomic<uint64_t> shadedPixels{0};
+        m_taskPool->parallelFor(static_cast<uint32_t>(m_bins.size()), [&](uint32_t tile)
+        {
+            if(m_bins[tile].empty())
+            {
+                return;
+            }
+            SOFTENGINE_TRACE_SCOPE("tile");
+
+            uint64_t tilePixels = 0;
+            auto rt = renderTarget();
+            rt.shadedPixels = &tilePixels;
+
+            const int tileMinX = (tile % m_tilesX) * m_tileSize;
+            const int tileMinY = (tile / m_tilesX) * m_tileSize;
+            const int tileMaxX = tileMinX + m_tileSize - 1;
+            const int tileMaxY = tileMinY + m_tileSize - 1;
+
+            prepareTile(tile);
+
+            // Note: the visibility buffer only holds this frame's triangles
+            if(m_deferredShading)
+            {
+                rt.visibility = m_visibilityBuffer.data();
+                forEachTileLine(tile, [&](int begin, int count)
+                {
+                    std::fill_n(m_visibilityBuffer.begin() + begin, count, noTriangle);
+                });
+            }
+
+            for(const auto i : m_bins[tile])
+            {
+                // the same triangle, with its bounding box clipped to the tile
+                auto t = m_triangles[i];
+                t.minX = std::max(t.minX, tileMinX);
+                t.minY = std::max(t.minY, tileMinY);
+                t.maxX = std::min(t.maxX, tileMaxX);
+                t.maxY = std::min(t.maxY, tileMaxY);
+                t.id = i;
+
+                rasterize(t, rt, m_simdLevel);
+            }
+
+            shadedPixels += m_deferredShading ? shadeTile(tile) : tilePixels;
+            drawnPixels += tilePixels;
+        });
+
+        m_stats.pixels += drawnPixels;
+        m_stats.shaded += shadedPixels;
+        m_triangles.clear();
+    }
+
+    // The shading pass of deferred shading: each pixel of the tile covered
+    // by a triangle this frame is shaded from that triangle's setup
+    // Note: neighbour pixels mostly belong to the same triangle, so each
+    // line is shaded by runs of pixels of the same triangle
+    // Returns the number of pixels shaded
+    uint64_t shadeTile(int tile)
+    {
+        SOFTENGINE_TRACE_SCOPE("shading");
+        uint64_t shaded = 0;
+        forEachTileLine(tile, [&](int begin, int count)
+        {
+            const int y = begin / m_winWidth;
+            const int minX = begin % m_winWidth;
+            const auto *ids = m_visibilityBuffer.data() + begin;
+            for(int i = 0; i < count; )
+            {
+                const auto id = ids[i];
+                int end = i + 1;
+                while(end < count && ids[end] == id)
+                {
+                    end++;
+                }
+
+                if(id != noTriangle)
+                {
+                    shadeSpan(m_triangles[id], minX + i, y, end - i, m_colorBuffer.data() + begin + i, m_simdLevel);
+                    shaded += end - i;
+                }
+                i = end;
+            }
+        });
+        return shaded;
+    }
+
+    // Project takes some 3D coordinates and transform them
+    // in 2D coordinates using the transformation matrix
+    // It also transform the same coordinates and the normal to the vertex
+    // in the 3D world
+    // Note: "project" can be seen as a "vertex shader"
+    // Note: this is the reference, one vertex at a time, implementation.
+    // render() transforms whole meshes at once with transformVertices()
+    Vertex project(glm::vec3 coordinates, glm::vec3 normal,
+                   const glm::mat4x4 &mvMat, const glm::mat4x4 &projMat)
+    {
+        const auto viewport = glm::vec4(0, 0, m_winWidth, m_winHeight);
+
+        // transforming the coordinates into 2D space
+        const auto point2d = glm::project(coordinates, mvMat, projMat, viewport);
+
+        // transforming the coordinates & the normal to the vertex in the 3D world
+        const auto  point3dWorld = mvMat * glm::vec4(coordinates.x, coordinates.y, coordinates.z, 1.0f);
+        // Note: w = 0, a direction is not affected by the translation
+        const auto normal3dWorld = mvMat * glm::vec4(normal.x, normal.y, normal.z, 0.0f);
+
+        const auto clip = viewportMatrix(m_winWidth, m_winHeight) * projMat * point3dWorld;
+
+        return {
+            point2d,        // coordinate
+            point3dWorld,   // worldCoodinate
+            normal3dWorld,  // normal
+            clip,           // clip
+            glm::vec2(0.0f) // uv: not known here
+        };
+    }
+
+    // Clipping happens on the vertices' clip coordinates (x, y, z, w), which are
+    // screen coordinates before the perspective divide. The triangles are clipped
+    // against the near plane (z >= 0), and against a guard band around the
+    // screen instead of the screen edges: the rasterizers already skip the pixels
+    // out of the screen, so only the rare triangles beyond the guard band need
+    // new vertices, and the coordinates reaching the rasterizers stay bounded.
+    enum ClipPlane : uint8_t
+    {
+        ClipNear   = 1 << 0,
+        ClipLeft   = 1 << 1,
+        ClipRight  = 1 << 2,
+        ClipBottom = 1 << 3,
+        ClipTop    = 1 << 4,
+    };
+    static constexpr int clipPlaneCount = 5;
+
+    // Guard band size, on each side of the screen, in screen sizes
+    static constexpr float guardBand = 1.0f;
+
+    // Signed distance (not normalized) to a clip plane, positive inside
+    float clipDistance(const glm::vec4 &c, int plane) const
+    {
+        const float minX = -guardBand * m_winWidth;
+        const float maxX = (1.0f + guardBand) * m_winWidth;
+        const float minY = -guardBand * m_winHeight;
+        const float maxY = (1.0f + guardBand) * m_winHeight;
+
+        switch(1 << plane)
+        {
+            case ClipNear:   return c.z;
+            case ClipLeft:   return c.x - minX * c.w;
+            case ClipRight:  return maxX * c.w - c.x;
+            case ClipBottom: return c.y - minY * c.w;
+            case ClipTop:    return maxY * c.w - c.y;
+        }
+        return 0;
+    }
+
+    // One bit per plane the clip coordinates are outside of
+    uint8_t clipCode(const glm::vec4 &c) const
+    {
+        uint8_t code = 0;
+        for(int plane = 0; plane < clipPlaneCount; plane++)
+        {
+            if(clipDistance(c, plane) < 0)
+            {
+                code |= 1 << plane;
+            }
+        }
+        return code;
+    }
+
+    // Sutherland-Hodgman: the triangle is clipped plane after plane (only the
+    // planes in code), then the remaining convex polygon is drawn as a fan
+    // Note: clipping against 5 planes adds 5 vertices at most
+    void clipTriangle(const Vertex &v1, const Vertex &v2, const Vertex &v3, uint8_t code,
+                      bool backFaceCulling, color4 c, const Texture *texture)
+    {
+        std::array<Vertex, 3 + clipPlaneCount> polygon{ v1, v2, v3 };
+        std::array<Vertex, 3 + clipPlaneCount> clipped;
+        int count = 3;
+
+        for(int plane = 0; plane < clipPlaneCount && count >= 3; plane++)
+        {
+            if(!(code & (1 << plane)))
+            {
+                continue;
+            }
+
+            int clippedCount = 0;
+            for(int i = 0; i < count; i++)
+            {
+                const auto &current = polygon[i];
+                const auto &next = polygon[(i + 1) % count];
+                const float dCurrent = clipDistance(current.clip, plane);
+                const float dNext = clipDistance(next.clip, plane);
+
+                if(dCurrent >= 0)
+                {
+                    clipped[clippedCount++] = current;
+                }
+                // the edge crosses the plane: new vertex on the plane
+                if((dCurrent >= 0) != (dNext >= 0))
+                {
+                    const float t = dCurrent / (dCurrent - dNext);
+                    clipped[clippedCount++] = lerpVertex(current, next, t);
+                }
+            }
+
+            polygon = clipped;
+            count = clippedCount;
+        }
+
+        for(int i = 1; i + 1 < count; i++)
+        {
+            submitTriangle(polygon[0], polygon[i], polygon[i + 1], backFaceCulling, c, texture);
+        }
+    }
+
+    // New vertex on the edge v1 v2, projected again from its clip coordinates
+    static Vertex lerpVertex(const Vertex &v1, const Vertex &v2, float t)
+    {
+        Vertex v;
+        v.clip = v1.clip + (v2.clip - v1.clip) * t;
+        v.worldCoordinates = v1.worldCoordinates + (v2.worldCoordinates - v1.worldCoordinates) * t;
+        v.normal = v1.normal + (v2.normal - v1.normal) * t;
+        v.uv = v1.uv + (v2.uv - v1.uv) * t;
+        v.coordinates = glm::vec3(v.clip) * (1.0f / v.clip.w);
+        return v;
+    }
+
+    void submitTriangle(const Vertex &v1, const Vertex &v2, const Vertex &v3,
+                        bool backFaceCulling, color4 c, const Texture *texture)
+    {
+        if(backFaceCulling && isBackFace(v1, v2, v3))
+        {
+            return;
+        }
+        drawTriangle(v1, v2, v3, c, texture);
+    }
+
+    // A face is seen from the back when its projected vertices turn clockwise
+    // Note: on screen, Y goes up (see glm::project)
+    static bool isBackFace(const Vertex &v1, const Vertex &v2, const Vertex &v3)
+    {
+        const auto p1 = v1.coordinates;
+        const auto p2 = v2.coordinates;
+        const auto p3 = v3.coordinates;
+
+        return (p2.x - p1.x) * (p3.y - p1.y) - (p2.y - p1.y) * (p3.x - p1.x) <= 0;
+    }
+
+    // Triangle stage of a mesh, for each type of index
+    template<typename Index>
+    void processFaces(const Mesh &mesh, const MeshBuffer<BasicFace<Index>> &faces)
+    {
+        uint32_t faceIdx = 0;
+        for(const auto face : faces)
+        {
+            const auto &pixelA = m_projectedVertices[face.a];
+            const auto &pixelB = m_projectedVertices[face.b];
+            const auto &pixelC = m_projectedVertices[face.c];
+
+            const bool alt = (faceIdx % 2 == 0);
+            faceIdx++;
+            const color4 color{alt ? 255 : 0, 0, alt ? 0 : 255, 255};
+
+            const auto codeA = clipCode(pixelA.clip);
+            const auto codeB = clipCode(pixelB.clip);
+            const auto codeC = clipCode(pixelC.clip);
+
+            // all the vertices beyond the same plane: nothing to draw
+            if(codeA & codeB & codeC)
+            {
+                continue;
+            }
+
+            // most triangles are entirely inside the guard band
+            if((codeA | codeB | codeC) == 0)
+            {
+                submitTriangle(pixelA, pixelB, pixelC, mesh.backFaceCulling, color, mesh.texture.get());
+            }
+            else
+            {
+                clipTriangle(pixelA, pixelB, pixelC, codeA | codeB | codeC,
+                             mesh.backFaceCulling, color, mesh.texture.get());
+            }
+        }
+    }
+
+    // The main method of the engine that re-compute each vertex projection during each frame
+    void render(const Camera &camera, const std::vector<Mesh> &meshes)
+    {
+        SOFTENGINE_TRACE_SCOPE("render");
+        m_stats = {};
+
+        const auto viewMat = glm::lookAtLH(camera.position, camera.target, glm::vec3(0,1,0));
+        const auto projMat = glm::perspectiveFovLH(
+            0.78f,
+            static_cast<float>(m_winWidth),
+            static_cast<float>(m_winHeight),
+            0.01f,
+            1.0f
+        );
+
+        // Mesh stage: the meshes out of view, or hidden behind others, are skipped
+        m_meshModelViews.resize(meshes.size());
+        m_meshVisible.resize(meshes.size());
+        for(size_t i = 0; i < meshes.size(); i++)
+        {
+            const auto &mesh = meshes[i];
+
+            // Beware to apply rotation before translation
+            const auto transMat = glm::translate(glm::mat4(1.0f), mesh.position);
+            const auto rotXMat = glm::rotate(transMat, mesh.rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+            const auto rotYMat = glm::rotate(rotXMat, mesh.rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
+            const auto rotZMat = glm::rotate(rotYMat, mesh.rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
+            const auto modelMat = rotZMat;
+            // Note1: the tutorial names this matrice "worldMatrice".
+            // Giving up the nice Futurama quote, and naming it "modelMatrice" to follow GDM examples.
+
+            // Note2: the tutorial merges all matrices at last
+            // const auto mvpMap = projMat * viewMat * modelMat;
+            // …but GLM project function expects ModelView and Projection matrices separately
+            m_meshModelViews[i] = viewMat * modelMat;
+
+            // Skipping the meshes entirely out of view
+            m_meshVisible[i] = isVisible(extractFrustum(projMat * m_meshModelViews[i]), mesh.bounds);
+        }
+
+        if(m_occlusionCulling)
+        {
+            cullOccludedMeshes(meshes, projMat);
+        }
+
+        m_meshLods.resize(meshes.size(), 0);
+        for(size_t i = 0; i < meshes.size(); i++)
+        {
+            if(!m_meshVisible[i])
+            {
+                continue;
+            }
+            const auto &mesh = meshes[i];
+            const auto &mvMat = m_meshModelViews[i];
+            m_stats.meshes++;
+
+            // the level of detail to draw: the full mesh, or one of its lods
+            m_meshLods[i] = selectLod(mesh, mvMat, projMat, m_meshLods[i]);
+            const auto &vertices = m_meshLods[i] == 0 ? mesh.vertices : mesh.lods[m_meshLods[i] - 1].vertices;
+            const auto &faceBuffer = m_meshLods[i] == 0 ? mesh.faces : mesh.lods[m_meshLods[i] - 1].faces;
+
+            // Vertex stage: each vertex is projected once,
+            // whatever the number of faces sharing it
+            {
+                SOFTENGINE_TRACE_SCOPE("vertex stage");
+                m_projectedVertices.resize(vertices.size());
+                transformVertices(vertices,
+                                  makeVertexTransform(mvMat, projMat, m_winWidth, m_winHeight),
+                                  m_projectedVertices.data(),
+                                  m_simdLevel);
+            }
+
+            // Triangle stage: faces only index the projected vertices
+            // Note: with the scanline rasterizer, this also draws the triangles
+            SOFTENGINE_TRACE_SCOPE("triangle stage");
+            faceBuffer.visit([&](const auto &faces) { processFaces(mesh, faces); });
+        }
+
+        rasterizeTiles();
+    }
+
+private:
+    // A level of detail is drawn while its error, projected at the distance
+    // of the mesh's bounding sphere, stays below lodThreshold() pixels. Going
+    // to a coarser level needs some margin (lodHysteresis), so that a mesh
+    // moving around a threshold does not alternate between two levels.
+    static constexpr float lodHysteresis = 0.25f;
+
+    // Level of detail to draw for a mesh (0: the full mesh, n: mesh.lods[n-1]),
+    // given the one drawn at the previous frame
+    // Note: the errors are scaled like the bounding sphere, whose radius is
+    // mesh.bounds.radius * pixelsPerUnit pixels on screen
+    size_t selectLod(const Mesh &mesh, const glm::mat4x4 &mvMat, const glm::mat4x4 &projMat, size_t current) const
+    {
+        const float distance = (mvMat * glm::vec4(mesh.bounds.center, 1.0f)).z;
+        if(mesh.lods.empty() || m_lodThreshold <= 0.0f || distance <= mesh.bounds.radius)
+        {
+            return 0;   // e.g. the camera is inside the sphere
+        }
+        current = std::min(current, mesh.lods.size());
+
+        const float pixelsPerUnit = projMat[1][1] * 0.5f * m_winHeight / distance;
+        const auto errorOnScreen = [&](size_t lod)
+        {
+            return lod == 0 ? 0.0f : mesh.lods[lod - 1].error * pixelsPerUnit;
+        };
+
+        // finer levels while the current one is too coarse
+        while(current > 0 && errorOnScreen(current) > m_lodThreshold)
+        {
+            current--;
+        }
+        // coarser levels while they are well below the threshold
+        while(current < mesh.lods.size() &&
+              errorOnScreen(current + 1) <= m_lodThreshold * (1.0f - lodHysteresis))
+        {
+            current++;
+        }
+        return current;
+    }
+
+    // Occlusion culling: a few big meshes (the occluders) are first drawn,
+    // depth only, into a small depth buffer, and the meshes whose screen
+    // bounding box is behind this depth everywhere are skipped.
+    // The occluders are made conservative: their triangles are shrunk to the
+    // pixels they entirely cover, with the farthest depth over each pixel.
+    // Note: this reuses the half-space kernels, drawing into a dummy color buffer
+    static constexpr int occlusionWidth = 256;
+    static constexpr int occlusionHeight = 128;
+    static constexpr int maxOccluders = 8;
+    static constexpr int minOccluderArea = occlusionWidth * occlusionHeight / 64;   // in occlusion pixels
+
+    // Bounding box of a mesh in the occlusion buffer, and its nearest depth
+    struct ScreenBounds
+    {
+        bool valid;     // false when the box crosses the near plane
+        float minX;
+        float minY;
+        float maxX;
+        float maxY;
+        float minZ;
+    };
+
+    static ScreenBounds screenBounds(const Bounds &bounds, const glm::mat4x4 &mvpv)
+    {
+        ScreenBounds screen{ true,
+                             std::numeric_limits<float>::max(),
+                             std::numeric_limits<float>::max(),
+                             std::numeric_limits<float>::lowest(),
+                             std::numeric_limits<float>::lowest(),
+                             std::numeric_limits<float>::max() };
+        for(int corner = 0; corner < 8; corner++)
+        {
+            const glm::vec4 c = mvpv * glm::vec4(
+                (corner & 1) ? bounds.max.x : bounds.min.x,
+                (corner & 2) ? bounds.max.y : bounds.min.y,
+                (corner & 4) ? bounds.max.z : bounds.min.z,
+                1.0f);
+            if(c.z < 0 || c.w <= 0)
+            {
+                screen.valid = false;
+                return screen;
+            }
+
+            const float x = c.x / c.w;
+            const float y = c.y / c.w;
+            screen.minX = std::min(screen.minX, x);
+            screen.minY = std::min(screen.minY, y);
+            screen.maxX = std::max(screen.maxX, x);
+            screen.maxY = std::max(screen.maxY, y);
+            screen.minZ = std::min(screen.minZ, c.z / c.w);
+        }
+        return screen;
+    }
+
+    // Clears m_meshVisible for the meshes hidden behind the occluders
+    void cullOccludedMeshes(const std::vector<Mesh> &meshes, const glm::mat4x4 &projMat)
+    {
+        SOFTENGINE_TRACE_SCOPE("occlusion culling");
+        // screen bounds of the visible meshes
+        m_meshScreenBounds.resize(meshes.size());
+        m_occluders.clear();
+        for(size_t i = 0; i < meshes.size(); i++)
+        {
+            if(!m_meshVisible[i])
+            {
+                continue;
+            }
+
+            const auto mvpv = viewportMatrix(occlusionWidth, occlusionHeight) * projMat * m_meshModelViews[i];
+            m_meshScreenBounds[i] = screenBounds(meshes[i].bounds, mvpv);
+            m_occluders.push_back(static_cast<uint32_t>(i));
+        }
+
+        // nothing to hide, or nothing to hide behind
+        if(m_occluders.size() < 2)
+        {
+            return;
+        }
+
+        // the occluders are the biggest meshes on screen
+        const auto area = [&](uint32_t i)
+        {
+            const auto &b = m_meshScreenBounds[i];
+            return b.valid ? (b.maxX - b.minX) * (b.maxY - b.minY) : 0.0f;
+        };
+        std::sort(m_occluders.begin(), m_occluders.end(), [&](uint32_t i, uint32_t j)
+        {
+            return area(i) > area(j);
+        });
+        while(!m_occluders.empty() &&
+              (m_occluders.size() > maxOccluders || area(m_occluders.back()) < minOccluderArea))
+        {
+            m_occluders.pop_back();
+        }
+        if(m_occluders.empty())
+        {
+            return;
+        }
+
+        drawOccluders(meshes, projMat);
+
+        // the meshes behind the occluders' depth on all the pixels of their bounding box
+        for(size_t i = 0; i < meshes.size(); i++)
+        {
+            const auto &b = m_meshScreenBounds[i];
+            if(!m_meshVisible[i] || !b.valid ||
+               std::find(m_occluders.begin(), m_occluders.end(), i) != m_occluders.end())
+            {
+                continue;
+            }
+
+            const int minX = std::max(0, static_cast<int>(std::floor(b.minX)));
+            const int minY = std::max(0, static_cast<int>(std::floor(b.minY)));
+            const int maxX = std::min(occlusionWidth  - 1, static_cast<int>(std::floor(b.maxX)));
+            const int maxY = std::min(occlusionHeight - 1, static_cast<int>(std::floor(b.maxY)));
+
+            bool occluded = minX <= maxX && minY <= maxY;
+            for(int y = minY; occluded && y <= maxY; y++)
+            {
+                const float *depth = m_occlusionDepth.data() + y*occlusionWidth;
+                for(int x = minX; x <= maxX; x++)
+                {
+                    if(depth[x] >= b.minZ)
+                    {
+                        occluded = false;
+                        break;
+                    }
+                }
+            }
+
+            if(occluded)
+            {
+                m_meshVisible[i] = false;
+            }
+        }
+    }
+
+    void drawOccluders(const std::vector<Mesh> &meshes, const glm::mat4x4 &projMat)
+    {
+        m_occlusionDepth.assign(occlusionWidth * occlusionHeight, std::numeric_limits<float>::max());
+        m_occlusionIds.resize(occlusionWidth * occlusionHeight);
+        m_occlusionHizMin.assign((occlusionWidth / hizBlockSize) * (occlusionHeight / hizBlockSize), std::numeric_limits<float>::max());
+        m_occlusionHizMax.assign(m_occlusionHizMin.size(), std::numeric_limits<float>::max());
+        // Note: only the depth matters, the triangles' ids are written
+        // instead of their colors, as it is cheaper
+        const RenderTarget rt{ nullptr, m_occlusionIds.data(), m_occlusionDepth.data(), occlusionWidth, occlusionHeight,
+                               m_occlusionHizMin.data(), m_occlusionHizMax.data(), occlusionWidth / hizBlockSize,
+                               &m_occlusionPixels };
+
+        // Note: occluders are not clipped, their triangles crossing the near plane
+        // or the guard band are left out, which only makes them hide less
+        const auto outside = [](const glm::vec4 &c)
+        {
+            return c.z < 0 ||
+                   c.x < -guardBand * occlusionWidth * c.w  || c.x > (1.0f + guardBand) * occlusionWidth * c.w ||
+                   c.y < -guardBand * occlusionHeight * c.w || c.y > (1.0f + guardBand) * occlusionHeight * c.w;
+        };
+
+        for(const auto i : m_occluders)
+        {
+            const auto &mesh = meshes[i];
+            m_occluderVertices.resize(mesh.vertices.size());
+            transformVertices(mesh.vertices,
+                              makeVertexTransform(m_meshModelViews[i], projMat, occlusionWidth, occlusionHeight),
+                              m_occluderVertices.data(),
+                              m_simdLevel);
+
+            mesh.faces.visit([&](const auto &faces)
+            {
+                for(const auto face : faces)
+                {
+                    const auto &v1 = m_occluderVertices[face.a];
+                    const auto &v2 = m_occluderVertices[face.b];
+                    const auto &v3 = m_occluderVertices[face.c];
+                    if(outside(v1.clip) || outside(v2.clip) || outside(v3.clip) ||
+                       (mesh.backFaceCulling && isBackFace(v1, v2, v3)))
+                    {
+                        continue;
+                    }
+
+                    TriangleSetup t;
+                    if(!setupTriangle(v1.coordinates, v2.coordinates, v3.coordinates,
+                                      occlusionWidth, occlusionHeight, t))
+                    {
+                        continue;
+                    }
+
+                    // shrinking: on a pixel, an edge function is at least its value
+                    // at the center minus half its gradient's L1 norm, and Z at most
+                    // its value at the center plus the same
+                    for(int e = 0; e < 3; e++)
+                    {
+                        t.c[e] -= (std::abs(int64_t(t.a[e])) + std::abs(int64_t(t.b[e])) + 1) / 2;
+                    }
+                    t.z0 += 0.5f * (std::abs(t.dzdx) + std::abs(t.dzdy));
+                    t.color = 0;
+
+                    rasterize(t, rt, m_simdLevel);
+                }
+            });
+        }
+    }
+
+    // Pending clear of a screen tile (see clear())
+    struct TileState
+    {
+        bool cleared = false;       // cleared by clear(), memory not written yet
+        bool depthClean = false;    // depth & hierarchical Z hold the cleared values
+        bool colorClean = false;    // color holds cleanColor
+        uint32_t cleanColor = 0;
+    };
+
+    // Calls f(begin, count) for each line of the tile, as indices in the buffers
+    template<typename F>
+    void forEachTileLine(int tile, F f) const
+    {
+        const int minX = (tile % m_tilesX) * m_tileSize;
+        const int minY = (tile / m_tilesX) * m_tileSize;
+        const int width = std::min(m_tileSize, m_winWidth - minX);
+        const int maxY = std::min(minY + m_tileSize, static_cast<int>(m_winHeight));
+        for(int y = minY; y < maxY; y++)
+        {
+            f(minX + y*m_winWidth, width);
+        }
+    }
+
+    void fillTileColor(int tile)
+    {
+        auto &state = m_tileStates[tile];
+        if(state.colorClean && state.cleanColor == m_clearColor)
+        {
+            return;
+        }
+
+        forEachTileLine(tile, [&](int begin, int count)
+        {
+            std::fill_n(m_colorBuffer.begin() + begin, count, m_clearColor);
+        });
+        state.colorClean = true;
+        state.cleanColor = m_clearColor;
+    }
+
+    void fillTileDepth(int tile)
+    {
+        auto &state = m_tileStates[tile];
+        if(state.depthClean)
+        {
+            return;
+        }
+
+        forEachTileLine(tile, [&](int begin, int count)
+        {
+            std::fill_n(m_depthBuffer.begin() + begin, count, std::numeric_limits<float>::max());
+        });
+
+        // Note: tiles are made of whole hierarchical Z blocks
+        const int minX = (tile % m_tilesX) * m_tileSize;
+        const int minY = (tile / m_tilesX) * m_tileSize;
+        const int maxX = std::min(minX + m_tileSize, static_cast<int>(m_winWidth));
+        const int maxY = std::min(minY + m_tileSize, static_cast<int>(m_winHeight));
+        for(int by = minY / hizBlockSize; by < (maxY + hizBlockSize - 1) / hizBlockSize; by++)
+        {
+            for(int bx = minX / hizBlockSize; bx < (maxX + hizBlockSize - 1) / hizBlockSize; bx++)
+            {
+                m_hizMin[bx + by*m_hizWidth] = std::numeric_limits<float>::max();
+                m_hizMax[bx + by*m_hizWidth] = std::numeric_limits<float>::max();
+                m_hizStale[bx + by*m_hizWidth] = false;
+            }
+        }
+        state.depthClean = true;
+    }
+
+    // To be called before drawing into a tile: finishes its pending clear
+    // Note: a tile is only accessed by one thread at a time (see rasterizeTiles)
+    void prepareTile(int tile)
+    {
+        auto &state = m_tileStates[tile];
+        if(state.cleared)
+        {
+            SOFTENGINE_TRACE_SCOPE("clear tile");
+            fillTileColor(tile);
+            fillTileDepth(tile);
+            state.cleared = false;
+        }
+        state.depthClean = false;
+        state.colorClean = false;
+    }
+
+    // Writes the cleared values of the tiles not drawn since clear()
+    // Note: they stay flagged as cleared, so drawing into them afterwards
+    // does not need to write them again
+    void resolveColor()
+    {
+        SOFTENGINE_TRACE_SCOPE("resolve color");
+        for(int tile = 0; tile < static_cast<int>(m_tileStates.size()); tile++)
+        {
+            if(m_tileStates[tile].cleared)
+            {
+                fillTileColor(tile);
+            }
+        }
+    }
+
+    void resolveDepth()
+    {
+        SOFTENGINE_TRACE_SCOPE("resolve depth");
+        for(int tile = 0; tile < static_cast<int>(m_tileStates.size()); tile++)
+        {
+            if(m_tileStates[tile].cleared)
+            {
+                fillTileDepth(tile);
+            }
+        }
+    }
+
+    RenderTarget renderTarget()
+    {
+        return { m_colorBuffer.data(), nullptr, m_depthBuffer.data(), m_winWidth, m_winHeight,
+                 m_hizMin.data(), m_hizMax.data(), m_hizWidth, &m_stats.pixels };
+    }
+
+    // True when the whole screen rectangle (inclusive) is already covered
+    // by something nearer than z, according to the hierarchical Z
+    // Note: the stale blocks in front of z are recomputed, when that is the
+    // only way left to skip the triangle, and it has paid lately
+    bool isOccluded(float z, int minX, int minY, int maxX, int maxY)
+    {
+        bool stale = false;
+        for(int by = minY / hizBlockSize; by <= maxY / hizBlockSize; by++)
+        {
+            for(int bx = minX / hizBlockSize; bx <= maxX / hizBlockSize; bx++)
+            {
+                const auto hiz = bx + by*m_hizWidth;
+                if(z <= m_hizMax[hiz])
+                {
+                    if(!m_hizStale[hiz])
+                    {
+                        return false;
+                    }
+                    stale = true;
+                }
+            }
+        }
+        if(stale && !hizRefreshPays())
+        {
+            return false;
+        }
+
+        for(int by = minY / hizBlockSize; stale && by <= maxY / hizBlockSize; by++)
+        {
+            for(int bx = minX / hizBlockSize; bx <= maxX / hizBlockSize; bx++)
+            {
+                if(z <= m_hizMax[bx + by*m_hizWidth])
+                {
+                    updateHiz(bx, by);
+                    if(z <= m_hizMax[bx + by*m_hizWidth])
+                    {
+                        m_hizRefreshes++;
+                        return false;
+                    }
+                }
+            }
+        }
+        if(stale)
+        {
+            m_hizRefreshes++;
+            m_hizRejections++;
+        }
+        return true;
+    }
+
+    // Recomputing the stale blocks costs as much as reading their depths:
+    // it pays when it lets enough triangles be skipped. When it has not in
+    // the last refreshes, it is only tried once in a while, as the scene or
+    // the drawing order may change.
+    bool hizRefreshPays()
+    {
+        if(m_hizRefreshes >= 64)
+        {
+            m_hizRefreshes /= 2;
+            m_hizRejections /= 2;
+        }
+        return m_hizRejections * 4 >= m_hizRefreshes || ++m_hizRefreshesSkipped % 16 == 0;
+    }
+
+    // Marks the hierarchical Z blocks overlapping the screen rectangle
+    // (inclusive) as stale: their farthest depth is only a bound
+    // Note: putPixel only keeps the nearest depth of a block up to date, so
+    // the scanline rasterizer calls this once a triangle is drawn, and the
+    // farthest depth is recomputed only if needed (see isOccluded)
+    void markHizStale(int minX, int minY, int maxX, int maxY)
+    {
+        for(int by = minY / hizBlockSize; by <= maxY / hizBlockSize; by++)
+        {
+            for(int bx = minX / hizBlockSize; bx <= maxX / hizBlockSize; bx++)
+            {
+                m_hizStale[bx + by*m_hizWidth] = true;
+            }
+        }
+    }
+
+    // Recomputes the nearest & farthest depths of a hierarchical Z block
+    void updateHiz(int bx, int by)
+    {
+        const int width = std::min(hizBlockSize, m_winWidth - bx * hizBlockSize);
+        const int height = std::min(hizBlockSize, m_winHeight - by * hizBlockSize);
+        const float *depth = m_depthBuffer.data() + (bx + by*m_winWidth) * hizBlockSize;
+        auto &zMin = m_hizMin[bx + by*m_hizWidth];
+        auto &zMax = m_hizMax[bx + by*m_hizWidth];
+        m_hizStale[bx + by*m_hizWidth] = false;
+#ifdef SOFTENGINE_X86_SIMD
+        if(m_simdLevel != SimdLevel::Scalar && width == hizBlockSize && height == hizBlockSize)
+        {
+            blockDepthRangeSSE41(depth, m_winWidth, zMin, zMax);
+            return;
+        }
+#endif
+        blockDepthRange(depth, m_winWidth, width, height, zMin, zMax);
+    }
+
+    // Called to put a pixel on screen at a specific X,Y coordinates
+    void putPixel(uint16_t x, uint16_t y, float z, color4 c)
+    {
+        const auto idx = x + y*m_winWidth;
+
+        if(m_depthBuffer[idx] < z)
+        {
+            return; // Discard
+        }
+        m_depthBuffer[idx] = z;
+        m_colorBuffer[idx] = toRGBA8888(c);
+        m_stats.pixels++;
+        m_stats.shaded++;
+
+        // Note: only the nearest depth of the block can change here,
+        // its farthest one stays a conservative bound (see markHizStale)
+        auto &hizMin = m_hizMin[x / hizBlockSize + (y / hizBlockSize) * m_hizWidth];
+        hizMin = std::min(hizMin, z);
+    }
+
+private:
+    const uint16_t m_winWidth;
+    const uint16_t m_winHeight;
+
+private:
+    std::unique_ptr<Presenter> m_presenter;
+    Rasterizer m_rasterizer = Rasterizer::Scanline;
+    SimdLevel m_simdLevel = detectSimdLevel();
+    bool m_occlusionCulling = true;
+    float m_lodThreshold = 0.5f;
+    bool m_deferredShading = false;
+
+private:
+    std::vector<uint32_t> m_colorBuffer; // back buffer, RGBA_8888
+    std::vector<float> m_depthBuffer;
+    std::vector<uint32_t> m_visibilityBuffer;   // deferred shading only, triangle ids
+    // Note: this needs to be the same type as inside glm::vec3
+    int m_hizWidth;                 // hierarchical Z, in blocks of hizBlockSize pixels
+    int m_hizHeight;
+    std::vector<float> m_hizMin;
+    std::vector<float> m_hizMax;
+    std::vector<bool> m_hizStale;       // scanline rasterizer: farthest depth only a bound (see markHizStale)
+    uint32_t m_hizRefreshes = 0;        // recent recomputes of stale blocks by isOccluded,
+    uint32_t m_hizRejections = 0;       // and the triangles they let skip (see hizRefreshPays)
+    uint32_t m_hizRefreshesSkipped = 0;
+
+private:
+    std::unique_ptr<TaskPool> m_taskPool;
+    int m_tileSize;
+    int m_tilesX;
+    int m_tilesY;
+    std::vector<Vertex> m_projectedVertices;    // post-transform vertices of the mesh being rendered
+    std::vector<TriangleSetup> m_triangles;     // queued by drawTriangle, in submission order
+    std::vector<std::vector<uint32_t>> m_bins;  // per tile, indices in m_triangles
+    std::vector<TileState> m_tileStates;
+    uint32_t m_clearColor = 0;
+
+private:
+    std::vector<glm::mat4x4> m_meshModelViews;  // per mesh, for the frame being rendered
+    std::vector<uint8_t> m_meshVisible;
+    std::vector<size_t> m_meshLods;             // level of detail drawn, kept from frame to frame
+    std::vector<ScreenBounds> m_meshScreenBounds;
+    std::vector<uint32_t> m_occluders;          // indices in the meshes
+    std::vector<Vertex> m_occluderVertices;
+    std::vector<float> m_occlusionDepth;        // occlusionWidth x occlusionHeight
+    std::vector<uint32_t> m_occlusionIds;       // unused, the kernels need one
+    std::vector<float> m_occlusionHizMin;
+    std::vector<float> m_occlusionHizMax;
+    uint64_t m_occlusionPixels = 0;
+
+private:
+    FrameStats m_stats = {};
+};
+
+#endif // SOFTENGINE_H